@@ -4,33 +4,171 @@
 #include <string.h>
 #include <stdio.h>
 #include <inttypes.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
 
 // Constant for heavy hitters size
 #define HEAVY_HITTERS_MAX_SIZE 6
 
+// Number of call sites tracked for peak reports (a power of 2)
+#define M61_SITES_SIZE 1024
+
+// Max number of site table slots probed for a call site
+#define M61_SITES_PROBE 32
+
+// Number of active_size samples kept in the time series
+#define M61_SAMPLES_SIZE 4096
+
+// Per-call-site memory accounting. `at_peak` is filled in lazily: it is
+// valid only when `stamp == peak_stamp`; otherwise the site has not
+// changed since the global peak, and its resident size at the peak is
+// still `active_size`.
+struct m61_site {
+    const char* file;                   // file of call site, NULL if unused
+    int line;                           // line of call site
+    unsigned long long active_size;     // # bytes active from this site
+    unsigned long long peak_size;       // largest active_size from this site
+    unsigned long long at_peak;         // active_size at the global peak
+    unsigned long long stamp;           // peak_stamp when at_peak was set
+};
+
+// Metadata stored immediately before every allocation. Which fields
+// exist depends on M61_LEVEL: the stats-only header holds just the size.
 struct m61_metadata {
     unsigned long long size;            // number of bytes in allocation
-    unsigned long long active_code;     // if equal to 1234 if allocation is not 'active'
-    char* ptr_addr;                     // address of the pointer to the allocation
+    unsigned align_offset;              // bytes from malloc'd block to this header
+#if M61_TAGGED
+    unsigned tag;                       // tag carried by the user pointer, 0 once freed
+#endif
+#if M61_LEVEL >= M61_LEVEL_LEAKS
     const char* file;                   // file in which allocation was called
     int line;                           // line in which allocation was called
     struct m61_metadata* prev;          // pointer to previous node in doubly linked list
     struct m61_metadata* next;          // pointer to next node in doubly linked list
-    int padding;                        // padding to keep struct with 8-bit alignment
-};
+    unsigned long long serial;          // value of ntotal when allocated
+    struct m61_site* site;              // call site entry for peak reports
+#endif
+#if M61_LEVEL >= M61_LEVEL_DEBUG
+    unsigned long long active_code;     // if equal to 1234 if allocation is not 'active'
+    char* ptr_addr;                     // address of the pointer to the allocation
+#endif
+} __attribute__((aligned(16)));         // keep user pointers 16-byte aligned
 
+#if M61_LEVEL >= M61_LEVEL_DEBUG
 // Footer to check for boundary write errors
 typedef struct m61_footer {
     unsigned long long buffer_one;      // 8-byte buffer for overflow
     unsigned long long buffer_two;      // 8-byte buffer for overflow
 } m61_footer;
+#define M61_FOOTER_SIZE sizeof(m61_footer)
+#else
+#define M61_FOOTER_SIZE 0
+#endif
 
 // Global struct to keep track of statistics
 struct m61_statistics global_stats;
 
+// Allocation number at which global_stats.peak_size was reached
+unsigned long long peak_ntotal = 0;
+
+// Number of active allocations whose header is not at the start of their
+// malloc'd block (see m61_memalign). While it is 0, sized frees need not
+// load align_offset.
+unsigned long long noffset = 0;
+
+// Time series of active_size, sampled every `sample_interval`
+// allocations (0 = off). When the buffer fills, every other sample is
+// dropped and the interval doubles, so the series always covers the
+// whole run.
+unsigned long long samples[M61_SAMPLES_SIZE];
+size_t nsamples = 0;
+unsigned long long sample_interval = 0;
+unsigned long long sample_countdown = 0;
+
+#if M61_TAGGED
+// Tag for the next allocation (never 0)
+unsigned next_tag = 0;
+#endif
+
+#if M61_LEVEL >= M61_LEVEL_LEAKS
 // Head doubly linked list of struct m61_metadata
 struct m61_metadata* metadata_head = NULL;
 
+// Hash table of call sites; the last entry collects overflow
+struct m61_site sites[M61_SITES_SIZE + 1];
+
+// Incremented every time the global peak grows
+unsigned long long peak_stamp = 0;
+
+// m61_find_site(file, line)
+//    Return the site table entry for `file:line`, adding it if necessary.
+//    A site with no free slot within M61_SITES_PROBE probes shares the
+//    overflow entry, so a crowded table never costs a full scan.
+static struct m61_site* m61_find_site(const char* file, int line) {
+    uintptr_t h = ((uintptr_t) file >> 3) * 31 + line;
+    for (int i = 0; i < M61_SITES_PROBE; ++i, ++h) {
+        struct m61_site* site = &sites[h & (M61_SITES_SIZE - 1)];
+        if (site->file == file && site->line == line)
+            return site;
+        else if (!site->file) {
+            site->file = file;
+            site->line = line;
+            return site;
+        }
+    }
+    sites[M61_SITES_SIZE].file = "?";
+    return &sites[M61_SITES_SIZE];
+}
+
+// m61_site_update(site, delta)
+//    Add `delta` bytes to the active size of `site`, first saving its
+//    resident size at the global peak if that is not yet recorded.
+static inline void m61_site_update(struct m61_site* site, long long delta) {
+    if (site->stamp != peak_stamp) {
+        site->at_peak = site->active_size;
+        site->stamp = peak_stamp;
+    }
+    site->active_size += delta;
+    if (site->active_size > site->peak_size)
+        site->peak_size = site->active_size;
+}
+#endif
+
+// m61_memory_bug()
+//    Abort after a MEMORY BUG report. Flushes stdout first so the report
+//    is not lost when output is redirected to a file.
+static void m61_memory_bug(void) {
+    fflush(stdout);
+    abort();
+}
+
+// m61_user_pointer(metadata)
+//    Return the pointer handed to the user for the allocation whose
+//    metadata is at `metadata`, including its tag in tagging mode.
+static void* m61_user_pointer(struct m61_metadata* metadata) {
+#if M61_TAGGED
+    return (void*) ((uintptr_t) (metadata + 1) | ((uintptr_t) metadata->tag << M61_TAG_SHIFT));
+#else
+    return metadata + 1;
+#endif
+}
+
+// m61_check_tag(ptr, file, line)
+//    In tagging mode, check that the tag in `ptr` matches its allocation's
+//    current tag. A mismatch means `ptr` is stale: it was already freed,
+//    or its memory has since been reallocated.
+static inline void m61_check_tag(void* ptr, const char* file, int line) {
+#if M61_TAGGED
+    struct m61_metadata* metadata = (struct m61_metadata*) M61_UNTAG(ptr) - 1;
+    if (metadata->tag != (uintptr_t) ptr >> M61_TAG_SHIFT) {
+        printf("MEMORY BUG: %s:%d: invalid free of pointer %p, stale or double free\n", file, line, ptr);
+        m61_memory_bug();
+    }
+#endif
+}
+
+#if M61_LEVEL >= M61_LEVEL_DEBUG
 // Global Array of Heavy Hitters
 struct m61_metadata heavy_hitters[HEAVY_HITTERS_MAX_SIZE];
 
@@ -52,171 +190,305 @@ void bs(struct m61_metadata* array, int n) {
     }
 }
 
-void* m61_malloc(size_t sz, const char* file, int line) {
-    (void) file, (void) line;   // avoid uninitialized variable warnings
-    // Your code here.
+// m61_sample_heavy_hitter(metadata)
+//    Randomly sample 1/20 allocations to identify heavy hitters
+static void m61_sample_heavy_hitter(struct m61_metadata* metadata) {
+    if (drand48() < .05) {
+        int flag = 0;
+        sample_size += metadata->size;
+        // Check if file/line number in array
+        for (int i = 0; i < HEAVY_HITTERS_MAX_SIZE; i++) {
+            if (heavy_hitters[i].file == metadata->file &&
+                heavy_hitters[i].line == metadata->line) {
+                heavy_hitters[i].size += metadata->size;
+                flag = 1;
+            }
+        }
+        // If file/line not present and array not full
+        if (!flag && heavy_hitters_size < HEAVY_HITTERS_MAX_SIZE) {
+            heavy_hitters[heavy_hitters_size] = *metadata;
+            heavy_hitters_size++;
+        }
+        // If metadata.size is bigger than last element in array
+        else {
+            if (!flag && heavy_hitters[HEAVY_HITTERS_MAX_SIZE - 1].size < metadata->size)
+                heavy_hitters[HEAVY_HITTERS_MAX_SIZE - 1] = *metadata;
+        }
+        bs(heavy_hitters, heavy_hitters_size);
+    }
+}
+
+// m61_check_free(new_ptr, ptr, file, line)
+//    Validate a free of `ptr` (whose metadata is at `new_ptr`). Prints a
+//    MEMORY BUG report and aborts if the free is invalid. In tagging mode
+//    the tag check replaces the active code and list neighbour checks.
+static void m61_check_free(struct m61_metadata* new_ptr, void* ptr, const char* file, int line) {
+    if ((char*) new_ptr < global_stats.heap_min || (char*) new_ptr > global_stats.heap_max) {
+        printf("MEMORY BUG: %s:%d: invalid free of pointer %p, not in heap\n", file, line, ptr);
+        m61_memory_bug();
+    }
+#if M61_TAGGED
+    m61_check_tag(ptr, file, line);
+#else
+    if (new_ptr->active_code == 1234) {
+        printf("MEMORY BUG: %s:%d: invalid free of pointer %p\n", file, line, ptr);
+        m61_memory_bug();
+    }
+#endif
+    if (new_ptr->ptr_addr != (char*) M61_UNTAG(ptr)) {
+        printf("MEMORY BUG: %s:%d: invalid free of pointer %p, not allocated\n", file, line, ptr);
+
+        for (struct m61_metadata* metadata = metadata_head; metadata != NULL; metadata = metadata->next) {
+            char* raw = (char*) M61_UNTAG(ptr);
+            if (raw >= (char*) metadata && raw <= (char*) (metadata + 1) + metadata->size + sizeof(m61_footer))
+                printf("  %s:%d: %p is %zu bytes inside a %llu byte region allocated here\n",
+                        metadata->file, metadata->line, ptr, raw - metadata->ptr_addr, metadata->size);
+        }
+        m61_memory_bug();
+    }
+#if !M61_TAGGED
+    // Ensure there are not multiple frees even with copy allocations
+    if (new_ptr->next) {
+        if (new_ptr->next->prev != new_ptr) {
+            printf("MEMORY BUG: %s%d: invalid free of pointer %p\n", file, line, ptr);
+            m61_memory_bug();
+        }
+    }
+    else if (new_ptr->prev) {
+        if (new_ptr->prev->next != new_ptr) {
+            printf("MEMEORY BUG: %s%d: invalid free of pointer %p\n", file, line, ptr);
+            m61_memory_bug();
+        }
+    }
+    else if ((new_ptr->prev && new_ptr->next) &&
+            (new_ptr->prev->next != new_ptr || new_ptr->next->prev != new_ptr)) {
+        printf("MEMORY BUG: %s%d: invalid free of pointer %p\n", file, line, ptr);
+        m61_memory_bug();
+    }
+#endif
+
+    m61_footer* footer_ptr = (m61_footer*) ((char*) (new_ptr + 1) + new_ptr->size);
+    if (footer_ptr->buffer_one != 1111 || footer_ptr->buffer_two != 2222) {
+        printf("MEMORY BUG: %s:%d: detected wild write during free of pointer %p\n", file, line, ptr);
+        m61_memory_bug();
+    }
+}
+#endif
+
+// m61_allocate(sz, alignment, file, line)
+//    Shared body of m61_malloc and m61_memalign. `alignment` is 0 for
+//    the default alignment (that of struct m61_metadata).
+static inline void* m61_allocate(size_t sz, size_t alignment, const char* file, int line) {
+    // Alignments up to the header's own come for free
+    if (alignment <= __alignof__(struct m61_metadata))
+        alignment = 0;
 
     // Prevent integer overflow: check to make sure sz not greater than 2^32-1
-    if (sz > SIZE_MAX - sizeof(struct m61_statistics) - sizeof(m61_footer)) {
+    if (sz > SIZE_MAX - sizeof(struct m61_metadata) - M61_FOOTER_SIZE - alignment) {
         global_stats.nfail++;
         global_stats.fail_size += sz;
         return NULL;
     }
 
-    // Initialize a footer to monitor boundary overwrite errors
-    m61_footer footer = {1111, 2222};
-
-    // Initialize struct to hold metadata (i.e. allocation size)
-    struct m61_metadata metadata = {sz, 0, NULL, file, line, NULL, NULL, 0};
-
     struct m61_metadata* ptr = NULL;
 
     // Allocate pointer w/ extra space to accommodate metadata
-    ptr = malloc(sizeof(struct m61_metadata) + sz + sizeof(m61_footer));
+    char* block = malloc(sizeof(struct m61_metadata) + sz + M61_FOOTER_SIZE + alignment);
 
     // Track failed allocations
-    if (!ptr) {
+    if (!block) {
         global_stats.nfail++;
         global_stats.fail_size += sz;
-        return ptr;
+        return NULL;
     }
 
+    // Place the header so the user pointer that follows it is aligned
+    if (alignment) {
+        uintptr_t user = ((uintptr_t) block + sizeof(struct m61_metadata) + alignment - 1)
+            & ~(uintptr_t) (alignment - 1);
+        ptr = (struct m61_metadata*) user - 1;
+    }
+    else
+        ptr = (struct m61_metadata*) block;
+    ptr->align_offset = (char*) ptr - block;
+    noffset += ptr->align_offset != 0;
+
     // Track other statistics
     global_stats.ntotal++;
     global_stats.nactive++;
     global_stats.total_size += sz;
     global_stats.active_size += sz;
 
-    char* heap_min = (char*) ptr;
-    char* heap_max = (char*) ptr + sz + sizeof(struct m61_metadata) + sizeof(m61_footer);
-    if (!global_stats.heap_min || global_stats.heap_min >= heap_min) {
-        global_stats.heap_min = heap_min;
+#if M61_LEVEL >= M61_LEVEL_LEAKS
+    ptr->site = m61_find_site(file, line);
+    m61_site_update(ptr->site, sz);
+#endif
+
+    // Track the peak; sites resident now are resident at the peak
+    if (global_stats.active_size > global_stats.peak_size) {
+        global_stats.peak_size = global_stats.active_size;
+        peak_ntotal = global_stats.ntotal;
+#if M61_LEVEL >= M61_LEVEL_LEAKS
+        ++peak_stamp;
+#endif
     }
 
-    if (!global_stats.heap_max || global_stats.heap_max <= heap_max) {
-        global_stats.heap_max = heap_max;
+    // Sample the time series
+    if (sample_interval && --sample_countdown == 0) {
+        if (nsamples == M61_SAMPLES_SIZE) {
+            for (size_t i = 0; i < M61_SAMPLES_SIZE / 2; ++i)
+                samples[i] = samples[2 * i + 1];
+            nsamples = M61_SAMPLES_SIZE / 2;
+            sample_interval *= 2;
+        }
+        samples[nsamples] = global_stats.active_size;
+        ++nsamples;
+        sample_countdown = sample_interval;
     }
 
-    // Update metadata with relevant information
-    metadata.ptr_addr = (char*) (ptr + 1);
-
     // Store metadata at beginning of allocated pointer
-    *ptr = metadata;
+    ptr->size = sz;
+#if M61_TAGGED
+    next_tag = (next_tag + 1) & 0xFFFF;
+    next_tag += !next_tag;
+    ptr->tag = next_tag;
+#endif
+
+#if M61_LEVEL >= M61_LEVEL_LEAKS
+    ptr->file = file;
+    ptr->line = line;
+    ptr->serial = global_stats.ntotal;
+    ptr->prev = NULL;
+    ptr->next = metadata_head;
+    if (metadata_head)
+        metadata_head->prev = ptr;
+    metadata_head = ptr;
+#endif
 
-    // Randomly sample 1/20 allocations to identify heavy hitters
-    if (drand48() < .05) {
-        int flag = 0;
-        sample_size += metadata.size;
-        // Check if file/line number in array
-        for (int i = 0; i < HEAVY_HITTERS_MAX_SIZE; i++) {
-            if (heavy_hitters[i].file == metadata.file &&
-                heavy_hitters[i].line == metadata.line) {
-                heavy_hitters[i].size += metadata.size;
-                flag = 1;
-            }
-        }
-        // If file/line not present and array not full
-        if (!flag && heavy_hitters_size < HEAVY_HITTERS_MAX_SIZE) {
-            heavy_hitters[heavy_hitters_size] = metadata;
-            heavy_hitters_size++;
-        }
-        // If metadata.size is bigger than last element in array
-        else {
-            if (!flag && heavy_hitters[HEAVY_HITTERS_MAX_SIZE - 1].size < metadata.size)
-                heavy_hitters[HEAVY_HITTERS_MAX_SIZE - 1] = metadata;
-        }
-        bs(heavy_hitters, heavy_hitters_size);
+#if M61_LEVEL >= M61_LEVEL_DEBUG
+    ptr->active_code = 0;
+    ptr->ptr_addr = (char*) (ptr + 1);
+
+    char* heap_min = block;
+    char* heap_max = (char*) ptr + sz + sizeof(struct m61_metadata) + sizeof(m61_footer);
+    if (!global_stats.heap_min || global_stats.heap_min >= heap_min) {
+        global_stats.heap_min = heap_min;
     }
 
-    if (metadata_head) {
-        ptr->next = metadata_head;
-        metadata_head->prev = ptr;
+    if (!global_stats.heap_max || global_stats.heap_max <= heap_max) {
+        global_stats.heap_max = heap_max;
     }
-    metadata_head = ptr;
 
+    m61_sample_heavy_hitter(ptr);
 
     // Store footer at the end of allocated pointer
+    m61_footer footer = {1111, 2222};
     m61_footer* footer_ptr = (m61_footer*) ((char*) (ptr + 1) + sz);
     *footer_ptr = footer;
+#endif
 
     // Return pointer to requested memory
-    return ptr + 1;
+    return m61_user_pointer(ptr);
 }
 
-void m61_free(void *ptr, const char *file, int line) {
+void* m61_malloc(size_t sz, const char* file, int line) {
+    return m61_allocate(sz, 0, file, line);
+}
+
+// m61_memalign(alignment, sz, file, line)
+//    Allocate `sz` bytes whose address is a multiple of `alignment`,
+//    which must be a power of 2. Returns NULL (and counts a failed
+//    allocation) if `alignment` is invalid.
+void* m61_memalign(size_t alignment, size_t sz, const char* file, int line) {
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+        global_stats.nfail++;
+        global_stats.fail_size += sz;
+        return NULL;
+    }
+    return m61_allocate(sz, alignment, file, line);
+}
+
+// m61_deallocate(ptr, sz, sized, file, line)
+//    Shared body of m61_free and m61_free_sized. If `sized` is true, the
+//    caller promises that `sz` is the allocation's size, so the free path
+//    need not load it from the header (debug builds still verify it).
+//    Unless memalign blocks are active, it need not load align_offset
+//    either, and below M61_LEVEL_DEBUG a sized free of an untagged
+//    pointer then reads no header fields at all.
+static inline void m61_deallocate(void* ptr, size_t sz, int sized, const char* file, int line) {
     (void) file, (void) line;   // avoid uninitialized variable warnings
     // Your code here.
-    if (ptr) {
-        struct m61_metadata* new_ptr = (struct m61_metadata*) ptr - 1;
-        if ((char*) new_ptr >= global_stats.heap_min && (char*) new_ptr <= global_stats.heap_max) {
-            if (new_ptr->active_code != 1234) {
-                if (new_ptr->ptr_addr != (char*) ptr) {
-                    printf("MEMORY BUG: %s:%d: invalid free of pointer %p, not allocated\n", file, line, ptr);
-
-                    for (struct m61_metadata* metadata = metadata_head; metadata != NULL; metadata = metadata->next) {
-                        if ((char*) ptr >= (char*) metadata && (char*) ptr <= (char*) (metadata + 1) + metadata->size + sizeof(m61_footer))
-                            printf("  %s:%d: %p is %zu bytes inside a %llu byte region allocated here\n", 
-                                    metadata->file, metadata->line, ptr, (char*) ptr - metadata->ptr_addr, metadata->size);
-                    }
-                    abort();
-                }
-                // Ensure there are not multiple frees even with copy allocations
-                if (new_ptr->next) {
-                    if (new_ptr->next->prev != new_ptr) {
-                        printf("MEMORY BUG: %s%d: invalid free of pointer %p\n", file, line, ptr);
-                        abort();
-                    }
-                }
-                else if (new_ptr->prev) {
-                    if (new_ptr->prev->next != new_ptr) {
-                        printf("MEMEORY BUG: %s%d: invalid free of pointer %p\n", file, line, ptr);
-                        abort();
-                    }
-                }
-                else if ((new_ptr->prev && new_ptr->next) &&
-                        (new_ptr->prev->next != new_ptr || new_ptr->next->prev != new_ptr)) {
-                    printf("MEMORY BUG: %s%d: invalid free of pointer %p\n", file, line, ptr);
-                    abort();
-                }
-
-                m61_footer* footer_ptr = (m61_footer*) ((char*) ptr + new_ptr->size);
-                if (footer_ptr->buffer_one != 1111 || footer_ptr->buffer_two != 2222) {
-                    printf("MEMORY BUG: %s:%d: detected wild write during free of pointer %p\n", file, line, ptr);
-                    abort();
-                }
-
-                // Remove node from doubly linked list
-                if (new_ptr->prev)
-                   new_ptr->prev->next = new_ptr->next;
-                else
-                    metadata_head = new_ptr->next;
-                if (new_ptr->next)
-                    new_ptr->next->prev = new_ptr->prev;
-
-                new_ptr->next = NULL;
-                new_ptr->prev = NULL;
-
-                // Keep track of statistics
-                global_stats.nactive--;
-                global_stats.active_size -= new_ptr->size;
-
-                // Set code to indicate inactive allocation
-                new_ptr->active_code = 1234;
-                free(new_ptr);
-            }
-            else {
-                printf("MEMORY BUG: %s:%d: invalid free of pointer %p\n", file, line, ptr);
-                abort();
-            }
-        }
-        else {
-            printf("MEMORY BUG: %s:%d: invalid free of pointer %p, not in heap\n", file, line, ptr);
-            abort();
-        }
+    if (!ptr)
+        return;
+
+    struct m61_metadata* new_ptr = (struct m61_metadata*) M61_UNTAG(ptr) - 1;
+
+#if M61_LEVEL >= M61_LEVEL_DEBUG
+    m61_check_free(new_ptr, ptr, file, line);
+    if (sized && sz != new_ptr->size) {
+        printf("MEMORY BUG: %s:%d: free of pointer %p with size %zu, but it has size %llu\n",
+               file, line, ptr, sz, new_ptr->size);
+        m61_memory_bug();
     }
+#else
+    m61_check_tag(ptr, file, line);
+#endif
+    unsigned long long size = sized ? sz : new_ptr->size;
+#if M61_TAGGED
+    new_ptr->tag = 0;
+#endif
+
+#if M61_LEVEL >= M61_LEVEL_LEAKS
+    // Remove node from doubly linked list
+    if (new_ptr->prev)
+        new_ptr->prev->next = new_ptr->next;
+    else
+        metadata_head = new_ptr->next;
+    if (new_ptr->next)
+        new_ptr->next->prev = new_ptr->prev;
+
+    new_ptr->next = NULL;
+    new_ptr->prev = NULL;
+
+    m61_site_update(new_ptr->site, -(long long) size);
+#endif
+
+    // Keep track of statistics
+    global_stats.nactive--;
+    global_stats.active_size -= size;
+
+#if M61_LEVEL >= M61_LEVEL_DEBUG
+    // Set code to indicate inactive allocation
+    new_ptr->active_code = 1234;
+#endif
+    unsigned offset = sized && !noffset ? 0 : new_ptr->align_offset;
+    noffset -= offset != 0;
+    free((char*) new_ptr - offset);
+}
+
+void m61_free(void *ptr, const char *file, int line) {
+    m61_deallocate(ptr, 0, 0, file, line);
+}
+
+// m61_free_sized(ptr, sz, file, line)
+//    Free `ptr`, which the caller knows was allocated with size `sz`.
+void m61_free_sized(void* ptr, size_t sz, const char* file, int line) {
+    m61_deallocate(ptr, sz, 1, file, line);
+}
+
+// m61_usable_size(ptr)
+//    Return the number of bytes the caller may use at `ptr`, which is
+//    the size it was allocated with. Returns 0 for NULL.
+size_t m61_usable_size(void* ptr) {
+    if (!ptr)
+        return 0;
+    return ((struct m61_metadata*) M61_UNTAG(ptr) - 1)->size;
 }
 
 void* m61_realloc(void* ptr, size_t sz, const char* file, int line) {
+    // Catch stale pointers before reading their size
+    if (ptr)
+        m61_check_tag(ptr, file, line);
     void* new_ptr = NULL;
     if (sz)
         new_ptr = m61_malloc(sz, file, line);
@@ -224,12 +496,12 @@ void* m61_realloc(void* ptr, size_t sz, const char* file, int line) {
         // Copy the data from `ptr` into `new_ptr`.
         // To do that, we must figure out the size of allocation `ptr`.
         // Your code here (to fix test012).
-        struct m61_metadata* metadata = (struct m61_metadata*) ptr - 1;
+        struct m61_metadata* metadata = (struct m61_metadata*) M61_UNTAG(ptr) - 1;
         size_t old_sz = metadata->size;
         if (old_sz <= sz)
-            memcpy(new_ptr, ptr, old_sz);
+            memcpy(M61_UNTAG(new_ptr), M61_UNTAG(ptr), old_sz);
         else
-            memcpy(new_ptr, ptr, sz);
+            memcpy(M61_UNTAG(new_ptr), M61_UNTAG(ptr), sz);
     }
     m61_free(ptr, file, line);
     return new_ptr;
@@ -243,7 +515,7 @@ void* m61_calloc(size_t nmemb, size_t sz, const char* file, int line) {
     }
     void* ptr = m61_malloc(nmemb * sz, file, line);
     if (ptr)
-        memset(ptr, 0, nmemb * sz);
+        memset(M61_UNTAG(ptr), 0, nmemb * sz);
     return ptr;
 }
 
@@ -266,14 +538,160 @@ void m61_printstatistics(void) {
            stats.active_size, stats.total_size, stats.fail_size);
 }
 
+// Leak reports need the live allocation list, so they print nothing
+// below M61_LEVEL_LEAKS.
 void m61_printleakreport(void) {
+#if M61_LEVEL >= M61_LEVEL_LEAKS
     for (struct m61_metadata* metadata = metadata_head; metadata != NULL; metadata = metadata->next) {
-        printf("LEAK CHECK: %s:%d: allocated object %p with size %llu\n", metadata->file, metadata->line, metadata->ptr_addr, metadata->size);
+        printf("LEAK CHECK: %s:%d: allocated object %p with size %llu\n", metadata->file, metadata->line, m61_user_pointer(metadata), metadata->size);
     }
+#endif
 }
 
 // Function to print out Heavy Hitters
 void m61_printheavyhitters(void) {
+#if M61_LEVEL >= M61_LEVEL_DEBUG
     for(int i = 0; i < HEAVY_HITTERS_MAX_SIZE; i++)
         printf("HEAVY HITTER: %s:%d: %llu bytes (%%~%.2f)\n", heavy_hitters[i].file, heavy_hitters[i].line, heavy_hitters[i].size, 100.0 * heavy_hitters[i].size / sample_size);
+#endif
+}
+
+
+#if M61_LEVEL >= M61_LEVEL_LEAKS
+// snapshot_write(fd, buf, n)
+//    Write all `n` bytes of `buf` to `fd`, retrying after short writes.
+//    If `fd` is nonblocking, waits in poll until it can take more.
+//    Returns 0 on success and -1 on error; a write that makes no
+//    progress is an error (EIO).
+static int snapshot_write(int fd, const char* buf, size_t n) {
+    while (n) {
+        ssize_t w = write(fd, buf, n);
+        if (w > 0) {
+            buf += w;
+            n -= w;
+        } else if (w == 0) {
+            errno = EIO;
+            return -1;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            struct pollfd pfd = { fd, POLLOUT, 0 };
+            if (poll(&pfd, 1, -1) < 0 && errno != EINTR)
+                return -1;
+        } else if (errno != EINTR)
+            return -1;
+    }
+    return 0;
+}
+#endif
+
+// m61_snapshot(fd)
+//    Write a binary snapshot of every active allocation (call site, size
+//    and age) to `fd`. The live allocation list is streamed through a
+//    fixed-size buffer, so the snapshot needs no memory proportional to
+//    the heap. Returns 0 on success and -1 on error; needs the live list,
+//    so always fails below M61_LEVEL_LEAKS.
+int m61_snapshot(int fd) {
+#if M61_LEVEL >= M61_LEVEL_LEAKS
+    char buf[4096];
+    size_t n = 0;
+
+    struct m61_snapshot_header header = {
+        M61_SNAPSHOT_MAGIC, M61_SNAPSHOT_VERSION,
+        global_stats.ntotal, global_stats.nactive
+    };
+    memcpy(buf, &header, sizeof(header));
+    n = sizeof(header);
+
+    for (struct m61_metadata* metadata = metadata_head; metadata != NULL; metadata = metadata->next) {
+        size_t file_len = metadata->file ? strlen(metadata->file) : 0;
+        if (file_len > sizeof(buf) - sizeof(struct m61_snapshot_record))
+            file_len = sizeof(buf) - sizeof(struct m61_snapshot_record);
+        // Flush the buffer if this record doesn't fit
+        if (n + sizeof(struct m61_snapshot_record) + file_len > sizeof(buf)) {
+            if (snapshot_write(fd, buf, n) < 0)
+                return -1;
+            n = 0;
+        }
+        struct m61_snapshot_record record = {
+            metadata->size, global_stats.ntotal - metadata->serial,
+            metadata->line, file_len
+        };
+        memcpy(buf + n, &record, sizeof(record));
+        if (file_len)
+            memcpy(buf + n + sizeof(record), metadata->file, file_len);
+        n += sizeof(record) + file_len;
+    }
+
+    return snapshot_write(fd, buf, n);
+#else
+    (void) fd;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+
+// m61_setsampleinterval(interval)
+//    Start sampling active_size every `interval` allocations, discarding
+//    any earlier samples. An interval of 0 turns sampling off.
+void m61_setsampleinterval(unsigned long long interval) {
+    sample_interval = sample_countdown = interval;
+    nsamples = 0;
+}
+
+// m61_getsamples(samples, n, interval)
+//    Copy up to `n` active_size samples, oldest first, into `samples`,
+//    and store the current sampling interval in `*interval`. Returns the
+//    number of samples copied.
+size_t m61_getsamples(unsigned long long* out, size_t n, unsigned long long* interval) {
+    if (n > nsamples)
+        n = nsamples;
+    memcpy(out, samples, n * sizeof(unsigned long long));
+    if (interval)
+        *interval = sample_interval;
+    return n;
+}
+
+#if M61_LEVEL >= M61_LEVEL_LEAKS
+// compare_at_peak(a, b)
+//    qsort comparator: sites with more bytes resident at the peak first.
+static int compare_at_peak(const void* a, const void* b) {
+    const struct m61_site* sa = *(const struct m61_site* const*) a;
+    const struct m61_site* sb = *(const struct m61_site* const*) b;
+    return sa->at_peak < sb->at_peak ? 1 : (sa->at_peak > sb->at_peak ? -1 : 0);
+}
+#endif
+
+// m61_printpeakreport()
+//    Print the global peak of active bytes and, at M61_LEVEL_LEAKS and
+//    above, the call sites that were resident at that peak. Also prints
+//    the active_size time series if sampling is on.
+void m61_printpeakreport(void) {
+    printf("PEAK: %llu bytes at allocation %llu\n", global_stats.peak_size, peak_ntotal);
+
+#if M61_LEVEL >= M61_LEVEL_LEAKS
+    struct m61_site* resident[M61_SITES_SIZE + 1];
+    int nresident = 0;
+    for (int i = 0; i <= M61_SITES_SIZE; ++i) {
+        struct m61_site* site = &sites[i];
+        if (site->file && site->stamp != peak_stamp) {
+            site->at_peak = site->active_size;
+            site->stamp = peak_stamp;
+        }
+        if (site->file && site->at_peak)
+            resident[nresident++] = site;
+    }
+    qsort(resident, nresident, sizeof(struct m61_site*), compare_at_peak);
+    for (int i = 0; i < nresident; ++i)
+        printf("PEAK SITE: %s:%d: %llu bytes at peak (%%~%.2f), site peak %llu bytes\n",
+               resident[i]->file, resident[i]->line, resident[i]->at_peak,
+               100.0 * resident[i]->at_peak / global_stats.peak_size,
+               resident[i]->peak_size);
+#endif
+
+    if (nsamples) {
+        printf("ACTIVE SIZE every %llu allocations:", sample_interval);
+        for (size_t i = 0; i < nsamples; ++i)
+            printf(" %llu", samples[i]);
+        printf("\n");
+    }
 }
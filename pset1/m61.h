@@ -1,11 +1,41 @@
 #ifndef M61_H
 #define M61_H 1
 #include <stdlib.h>
+#include <stdint.h>
+
+// Instrumentation levels. Define M61_LEVEL at compile time (for example,
+// `make M61_LEVEL=1`) to choose how much bookkeeping m61 performs.
+#define M61_LEVEL_STATS         1   // statistics counters only
+#define M61_LEVEL_LEAKS         2   // + live allocation list for leak reports
+#define M61_LEVEL_DEBUG         3   // + canaries, free checks, heavy hitters
+#ifndef M61_LEVEL
+#define M61_LEVEL               M61_LEVEL_DEBUG
+#endif
+
+// Pointer tagging. Build with M61_TAGGING=1 on a 64-bit target and m61
+// returns pointers whose top 16 bits carry a per-allocation tag, which
+// m61_free and m61_realloc check to catch stale and double frees. Tagged
+// pointers are not dereferenceable: strip the tag with M61_UNTAG first.
+#if M61_TAGGING && UINTPTR_MAX > 0xFFFFFFFFU
+#define M61_TAGGED              1
+#define M61_TAG_SHIFT           48
+#define M61_UNTAG(ptr)          ((__typeof__(ptr)) ((uintptr_t) (ptr) & (((uintptr_t) 1 << M61_TAG_SHIFT) - 1)))
+#else
+#define M61_TAGGED              0
+#define M61_UNTAG(ptr)          (ptr)
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
 
 void* m61_malloc(size_t sz, const char* file, int line);
 void m61_free(void* ptr, const char* file, int line);
 void* m61_realloc(void* ptr, size_t sz, const char* file, int line);
 void* m61_calloc(size_t nmemb, size_t sz, const char* file, int line);
+void* m61_memalign(size_t alignment, size_t sz, const char* file, int line);
+void m61_free_sized(void* ptr, size_t sz, const char* file, int line);
+size_t m61_usable_size(void* ptr);
 
 struct m61_statistics {
     unsigned long long nactive;         // # active allocations
@@ -14,6 +44,7 @@ struct m61_statistics {
     unsigned long long total_size;      // # bytes in total allocations
     unsigned long long nfail;           // # failed allocation attempts
     unsigned long long fail_size;       // # bytes in failed alloc attempts
+    unsigned long long peak_size;       // largest active_size ever seen
     char* heap_min;                     // smallest allocated addr
     char* heap_max;                     // largest allocated addr
 };
@@ -22,12 +53,43 @@ void m61_getstatistics(struct m61_statistics* stats);
 void m61_printstatistics(void);
 void m61_printleakreport(void);
 void m61_printheavyhitters(void);
+int m61_snapshot(int fd);
+void m61_printpeakreport(void);
+void m61_setsampleinterval(unsigned long long interval);
+size_t m61_getsamples(unsigned long long* samples, size_t n,
+                      unsigned long long* interval);
+
+// Heap snapshot format written by m61_snapshot and read by m61snapdiff:
+// one header followed by `nactive` records. Each record is followed by
+// `file_len` bytes of file name (not null-terminated).
+#define M61_SNAPSHOT_MAGIC      0x5336314DU     // "M61S"
+#define M61_SNAPSHOT_VERSION    1
+
+struct m61_snapshot_header {
+    uint32_t magic;                     // M61_SNAPSHOT_MAGIC
+    uint32_t version;                   // M61_SNAPSHOT_VERSION
+    uint64_t ntotal;                    // allocations made before the snapshot
+    uint64_t nactive;                   // # records that follow
+};
+
+struct m61_snapshot_record {
+    uint64_t size;                      // # bytes in allocation
+    uint64_t age;                       // # allocations made since this one
+    uint32_t line;                      // line in which allocation was called
+    uint32_t file_len;                  // length of file name that follows
+};
+
+#ifdef __cplusplus
+}
+#endif
 
 #if !M61_DISABLE
 #define malloc(sz)              m61_malloc((sz), __FILE__, __LINE__)
 #define free(ptr)               m61_free((ptr), __FILE__, __LINE__)
 #define realloc(ptr, sz)        m61_realloc((ptr), (sz), __FILE__, __LINE__)
 #define calloc(nmemb, sz)       m61_calloc((nmemb), (sz), __FILE__, __LINE__)
+#define aligned_alloc(al, sz)   m61_memalign((al), (sz), __FILE__, __LINE__)
+#define free_sized(ptr, sz)     m61_free_sized((ptr), (sz), __FILE__, __LINE__)
 #endif
 
 #endif
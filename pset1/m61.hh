@@ -0,0 +1,88 @@
+#ifndef M61_HH
+#define M61_HH 1
+#include <cstddef>
+#include <limits>
+#include <new>
+#include <source_location>
+#include "m61.h"
+
+// C++ support for m61 (requires C++20).
+//
+// Linking m61new.o replaces the global operator new and delete (plain,
+// array, sized, aligned and nothrow forms) with m61 versions, so every
+// C++ allocation is counted. Replacement operators cannot see their
+// caller, so they attribute allocations to the site M61_NEW_FILE:0. To
+// attribute allocations to real call sites, use `m61_new` in place of
+// `new`, and `m61_allocator<T>` for standard containers.
+
+#define M61_NEW_FILE "<operator new>"
+
+#if M61_TAGGED
+#error "m61 C++ support needs untagged pointers; build without M61_TAGGING"
+#endif
+
+// Placement forms taking a call site; `m61_new T(args)` uses these.
+void* operator new(std::size_t sz, const std::source_location& loc);
+void* operator new[](std::size_t sz, const std::source_location& loc);
+void* operator new(std::size_t sz, std::align_val_t al, const std::source_location& loc);
+void* operator new[](std::size_t sz, std::align_val_t al, const std::source_location& loc);
+// Called only if a constructor throws during `m61_new`.
+void operator delete(void* ptr, const std::source_location& loc) noexcept;
+void operator delete[](void* ptr, const std::source_location& loc) noexcept;
+void operator delete(void* ptr, std::align_val_t al, const std::source_location& loc) noexcept;
+void operator delete[](void* ptr, std::align_val_t al, const std::source_location& loc) noexcept;
+
+#define m61_new new (std::source_location::current())
+
+
+// m61_allocator<T>
+//    Standard allocator that allocates through m61. Allocations are
+//    attributed to the place the allocator was constructed. Containers
+//    that default-construct their allocator do so inside the library
+//    headers, so pass one explicitly to attribute to your own code:
+//        std::vector<int, m61_allocator<int>> v(m61_allocator<int>{});
+template <typename T>
+class m61_allocator {
+  public:
+    using value_type = T;
+
+    m61_allocator(std::source_location loc = std::source_location::current()) noexcept
+        : loc_(loc) {
+    }
+    template <typename U>
+    m61_allocator(const m61_allocator<U>& other) noexcept
+        : loc_(other.location()) {
+    }
+
+    T* allocate(std::size_t n) {
+        if (n > std::numeric_limits<std::size_t>::max() / sizeof(T))
+            throw std::bad_array_new_length();
+        void* ptr;
+        if (alignof(T) > __STDCPP_DEFAULT_NEW_ALIGNMENT__)
+            ptr = m61_memalign(alignof(T), n * sizeof(T), loc_.file_name(), loc_.line());
+        else
+            ptr = m61_malloc(n * sizeof(T), loc_.file_name(), loc_.line());
+        if (!ptr)
+            throw std::bad_alloc();
+        return static_cast<T*>(ptr);
+    }
+    void deallocate(T* ptr, std::size_t n) noexcept {
+        // The container knows the size, so skip the header read
+        m61_free_sized(ptr, n * sizeof(T), loc_.file_name(), loc_.line());
+    }
+
+    const std::source_location& location() const noexcept {
+        return loc_;
+    }
+
+  private:
+    std::source_location loc_;
+};
+
+// All m61 allocators share one heap, so any can free another's memory.
+template <typename T, typename U>
+inline bool operator==(const m61_allocator<T>&, const m61_allocator<U>&) noexcept {
+    return true;
+}
+
+#endif
@@ -0,0 +1,67 @@
+#include "m61.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#define NSLOTS 4096
+// m61bench: Measure the per-operation cost of m61 instrumentation.
+//
+// Keeps a working set of NSLOTS live allocations and repeatedly frees a
+// random slot and reallocates it with a random size. Build it against
+// each instrumentation level with `make bench`; the `raw` build calls
+// the system allocator directly.
+
+#if M61_DISABLE
+#define M61BENCH_LEVEL "raw"
+#elif M61_TAGGED
+#define M61BENCH_LEVEL "tagged"
+#elif M61_LEVEL == M61_LEVEL_STATS
+#define M61BENCH_LEVEL "stats"
+#elif M61_LEVEL == M61_LEVEL_LEAKS
+#define M61BENCH_LEVEL "leaks"
+#else
+#define M61BENCH_LEVEL "debug"
+#endif
+
+static void* slots[NSLOTS];
+
+// xorshift32 generator, so the benchmark does not measure random()
+static unsigned rng_state = 2463534242U;
+static unsigned rng(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+int main(int argc, char** argv) {
+#if M61_TAGGING && !M61_TAGGED
+    // Tagging needs 64-bit pointers; don't report the stats build as it
+    (void) argc, (void) argv;
+    printf("%-6s skipped, tagging needs a 64-bit target\n", "tagged");
+    return 0;
+#endif
+    unsigned long long count = 10000000;
+    if (argc > 1)
+        count = strtoull(argv[1], 0, 0);
+
+    struct timespec begin, end;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+
+    for (unsigned long long i = 0; i < count; ++i) {
+        unsigned r = rng();
+        unsigned slot = r % NSLOTS;
+        free(slots[slot]);
+        // sizes 1-256 bytes, with an occasional 4KiB allocation
+        size_t sz = (r >> 12) % 64 ? 1 + (r >> 16) % 256 : 4096;
+        slots[slot] = malloc(sz);
+        *(char*) M61_UNTAG(slots[slot]) = (char) i;
+    }
+    for (int i = 0; i < NSLOTS; ++i)
+        free(slots[i]);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double elapsed = (end.tv_sec - begin.tv_sec)
+        + (end.tv_nsec - begin.tv_nsec) / 1e9;
+    printf("%-6s %llu malloc/free pairs in %.3fs (%.1f ns/pair)\n",
+           M61BENCH_LEVEL, count, elapsed, elapsed * 1e9 / count);
+}
@@ -0,0 +1,118 @@
+#define M61_DISABLE 1
+#include "m61.hh"
+
+// m61new.cc
+//    Replacement global operator new and delete that allocate through
+//    m61, plus the call-site placement forms used by `m61_new`. Each
+//    operator calls straight into m61, so C++ allocations cost the same
+//    as C ones.
+
+// m61_operator_new(sz, al, file, line)
+//    Allocate for operator new, throwing std::bad_alloc on failure.
+//    `al` is 0 for the default alignment.
+static inline void* m61_operator_new(std::size_t sz, std::size_t al,
+                                     const char* file, int line) {
+    void* ptr = al ? m61_memalign(al, sz, file, line)
+        : m61_malloc(sz, file, line);
+    if (!ptr)
+        throw std::bad_alloc();
+    return ptr;
+}
+
+
+// Replaceable global allocation functions
+
+void* operator new(std::size_t sz) {
+    return m61_operator_new(sz, 0, M61_NEW_FILE, 0);
+}
+void* operator new[](std::size_t sz) {
+    return m61_operator_new(sz, 0, M61_NEW_FILE, 0);
+}
+void* operator new(std::size_t sz, std::align_val_t al) {
+    return m61_operator_new(sz, (std::size_t) al, M61_NEW_FILE, 0);
+}
+void* operator new[](std::size_t sz, std::align_val_t al) {
+    return m61_operator_new(sz, (std::size_t) al, M61_NEW_FILE, 0);
+}
+void* operator new(std::size_t sz, const std::nothrow_t&) noexcept {
+    return m61_malloc(sz, M61_NEW_FILE, 0);
+}
+void* operator new[](std::size_t sz, const std::nothrow_t&) noexcept {
+    return m61_malloc(sz, M61_NEW_FILE, 0);
+}
+void* operator new(std::size_t sz, std::align_val_t al, const std::nothrow_t&) noexcept {
+    return m61_memalign((std::size_t) al, sz, M61_NEW_FILE, 0);
+}
+void* operator new[](std::size_t sz, std::align_val_t al, const std::nothrow_t&) noexcept {
+    return m61_memalign((std::size_t) al, sz, M61_NEW_FILE, 0);
+}
+
+
+// Replaceable global deallocation functions. Sized forms pass the size
+// on to m61_free_sized, which skips the header read (and checks the
+// size in debug builds).
+
+void operator delete(void* ptr) noexcept {
+    m61_free(ptr, M61_NEW_FILE, 0);
+}
+void operator delete[](void* ptr) noexcept {
+    m61_free(ptr, M61_NEW_FILE, 0);
+}
+void operator delete(void* ptr, std::size_t sz) noexcept {
+    m61_free_sized(ptr, sz, M61_NEW_FILE, 0);
+}
+void operator delete[](void* ptr, std::size_t sz) noexcept {
+    m61_free_sized(ptr, sz, M61_NEW_FILE, 0);
+}
+void operator delete(void* ptr, std::align_val_t) noexcept {
+    m61_free(ptr, M61_NEW_FILE, 0);
+}
+void operator delete[](void* ptr, std::align_val_t) noexcept {
+    m61_free(ptr, M61_NEW_FILE, 0);
+}
+void operator delete(void* ptr, std::size_t sz, std::align_val_t) noexcept {
+    m61_free_sized(ptr, sz, M61_NEW_FILE, 0);
+}
+void operator delete[](void* ptr, std::size_t sz, std::align_val_t) noexcept {
+    m61_free_sized(ptr, sz, M61_NEW_FILE, 0);
+}
+void operator delete(void* ptr, const std::nothrow_t&) noexcept {
+    m61_free(ptr, M61_NEW_FILE, 0);
+}
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept {
+    m61_free(ptr, M61_NEW_FILE, 0);
+}
+void operator delete(void* ptr, std::align_val_t, const std::nothrow_t&) noexcept {
+    m61_free(ptr, M61_NEW_FILE, 0);
+}
+void operator delete[](void* ptr, std::align_val_t, const std::nothrow_t&) noexcept {
+    m61_free(ptr, M61_NEW_FILE, 0);
+}
+
+
+// Call-site placement forms for `m61_new`
+
+void* operator new(std::size_t sz, const std::source_location& loc) {
+    return m61_operator_new(sz, 0, loc.file_name(), loc.line());
+}
+void* operator new[](std::size_t sz, const std::source_location& loc) {
+    return m61_operator_new(sz, 0, loc.file_name(), loc.line());
+}
+void* operator new(std::size_t sz, std::align_val_t al, const std::source_location& loc) {
+    return m61_operator_new(sz, (std::size_t) al, loc.file_name(), loc.line());
+}
+void* operator new[](std::size_t sz, std::align_val_t al, const std::source_location& loc) {
+    return m61_operator_new(sz, (std::size_t) al, loc.file_name(), loc.line());
+}
+void operator delete(void* ptr, const std::source_location& loc) noexcept {
+    m61_free(ptr, loc.file_name(), loc.line());
+}
+void operator delete[](void* ptr, const std::source_location& loc) noexcept {
+    m61_free(ptr, loc.file_name(), loc.line());
+}
+void operator delete(void* ptr, std::align_val_t, const std::source_location& loc) noexcept {
+    m61_free(ptr, loc.file_name(), loc.line());
+}
+void operator delete[](void* ptr, std::align_val_t, const std::source_location& loc) noexcept {
+    m61_free(ptr, loc.file_name(), loc.line());
+}
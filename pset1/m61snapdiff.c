@@ -0,0 +1,144 @@
+#define M61_DISABLE 1
+#include "m61.h"
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+// m61snapdiff: Compare two m61_snapshot files by call site.
+//
+// Usage: ./m61snapdiff OLD NEW
+//    Prints every call site whose live allocations changed between the
+//    OLD and NEW snapshots, largest growth in bytes first. A site that
+//    keeps growing across snapshots of a long-running program is a good
+//    leak suspect.
+
+struct site {
+    char* file;                         // file name of call site
+    uint32_t line;                      // line of call site
+    unsigned long long count[2];        // # live allocations in each snapshot
+    unsigned long long bytes[2];        // # live bytes in each snapshot
+    unsigned long long max_age;         // oldest live allocation in NEW
+};
+
+static struct site* sites = NULL;
+static size_t nsites = 0;
+static size_t sites_capacity = 0;
+
+// Open-addressed hash index into `sites`: each slot holds a site index
+// plus 1, or 0 if empty. Always at most half full.
+static size_t* site_index = NULL;
+static size_t site_index_size = 0;
+
+// site_hash(file, file_len, line)
+//    Return a hash of call site `file:line` (FNV-1a).
+static size_t site_hash(const char* file, size_t file_len, uint32_t line) {
+    uint32_t h = 2166136261U ^ line;
+    for (size_t i = 0; i < file_len; ++i)
+        h = (h ^ (unsigned char) file[i]) * 16777619U;
+    return h;
+}
+
+// find_site(file, file_len, line)
+//    Return the site for `file:line`, adding it if necessary.
+static struct site* find_site(const char* file, size_t file_len, uint32_t line) {
+    // Grow the site array and rebuild the index when half full
+    if (2 * (nsites + 1) > site_index_size) {
+        sites_capacity = sites_capacity ? 2 * sites_capacity : 64;
+        sites = (struct site*) realloc(sites, sites_capacity * sizeof(struct site));
+        free(site_index);
+        site_index_size = 2 * sites_capacity;
+        site_index = (size_t*) calloc(site_index_size, sizeof(size_t));
+        if (!sites || !site_index) {
+            perror("m61snapdiff");
+            exit(1);
+        }
+        for (size_t i = 0; i < nsites; ++i) {
+            size_t h = site_hash(sites[i].file, strlen(sites[i].file), sites[i].line);
+            while (site_index[h % site_index_size])
+                ++h;
+            site_index[h % site_index_size] = i + 1;
+        }
+    }
+
+    size_t h = site_hash(file, file_len, line);
+    for (; site_index[h % site_index_size]; ++h) {
+        struct site* s = &sites[site_index[h % site_index_size] - 1];
+        if (s->line == line && strlen(s->file) == file_len
+            && memcmp(s->file, file, file_len) == 0)
+            return s;
+    }
+
+    struct site* s = &sites[nsites];
+    ++nsites;
+    site_index[h % site_index_size] = nsites;
+    memset(s, 0, sizeof(*s));
+    s->file = strndup(file, file_len);
+    s->line = line;
+    return s;
+}
+
+// read_snapshot(filename, which)
+//    Add the allocations in snapshot `filename` to the site table as
+//    snapshot number `which` (0 = OLD, 1 = NEW).
+static void read_snapshot(const char* filename, int which) {
+    FILE* f = fopen(filename, "rb");
+    if (!f) {
+        perror(filename);
+        exit(1);
+    }
+
+    struct m61_snapshot_header header;
+    if (fread(&header, sizeof(header), 1, f) != 1
+        || header.magic != M61_SNAPSHOT_MAGIC
+        || header.version != M61_SNAPSHOT_VERSION) {
+        fprintf(stderr, "%s: not an m61 snapshot\n", filename);
+        exit(1);
+    }
+
+    char file[4096];
+    for (uint64_t i = 0; i < header.nactive; ++i) {
+        struct m61_snapshot_record record;
+        if (fread(&record, sizeof(record), 1, f) != 1
+            || record.file_len > sizeof(file)
+            || fread(file, 1, record.file_len, f) != record.file_len) {
+            fprintf(stderr, "%s: truncated snapshot\n", filename);
+            exit(1);
+        }
+        struct site* s = find_site(file, record.file_len, record.line);
+        s->count[which]++;
+        s->bytes[which] += record.size;
+        if (which == 1 && record.age > s->max_age)
+            s->max_age = record.age;
+    }
+    fclose(f);
+}
+
+// compare_growth(a, b)
+//    qsort comparator: larger growth in live bytes sorts first.
+static int compare_growth(const void* a, const void* b) {
+    const struct site* sa = (const struct site*) a;
+    const struct site* sb = (const struct site*) b;
+    long long ga = (long long) (sa->bytes[1] - sa->bytes[0]);
+    long long gb = (long long) (sb->bytes[1] - sb->bytes[0]);
+    return ga < gb ? 1 : (ga > gb ? -1 : 0);
+}
+
+int main(int argc, char** argv) {
+    if (argc != 3) {
+        fprintf(stderr, "Usage: ./m61snapdiff OLD NEW\n");
+        exit(1);
+    }
+    read_snapshot(argv[1], 0);
+    read_snapshot(argv[2], 1);
+
+    qsort(sites, nsites, sizeof(struct site), compare_growth);
+    for (size_t i = 0; i < nsites; ++i) {
+        struct site* s = &sites[i];
+        if (s->count[0] == s->count[1] && s->bytes[0] == s->bytes[1])
+            continue;
+        printf("%s:%u: %+lld objects (%llu -> %llu), %+lld bytes (%llu -> %llu), oldest age %llu\n",
+               s->file, s->line,
+               (long long) (s->count[1] - s->count[0]), s->count[0], s->count[1],
+               (long long) (s->bytes[1] - s->bytes[0]), s->bytes[0], s->bytes[1],
+               s->max_age);
+    }
+}
@@ -0,0 +1,25 @@
+#include "m61.h"
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+// Tagging mode: tagged pointers untag to usable memory, and reallocating
+// and freeing live pointers works.
+
+int main() {
+    assert(M61_TAGGED);
+    char* p = (char*) malloc(100);
+    char* raw = M61_UNTAG(p);
+    assert(raw != p);
+    assert(M61_UNTAG(raw) == raw);
+    assert(M61_UNTAG(M61_UNTAG(p)) == raw);
+    strcpy(raw, "tagged");
+
+    char* q = (char*) realloc(p, 200);
+    assert(strcmp(M61_UNTAG(q), "tagged") == 0);
+    assert(m61_usable_size(q) == 200);
+    free(q);
+    m61_printstatistics();
+}
+
+//! malloc count: active          0   total          2   fail          0
+//! malloc size:  active          0   total        300   fail          0
@@ -0,0 +1,15 @@
+#include "m61.h"
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+// Tagging mode: double free.
+
+int main() {
+    void* ptr = malloc(2001);
+    free(ptr);
+    free(ptr);
+    m61_printstatistics();
+}
+
+//! MEMORY BUG: tagtest???.c:10: invalid free of pointer ???, stale or double free
+//! ???
@@ -0,0 +1,17 @@
+#include "m61.h"
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+// Tagging mode: realloc of a stale pointer after its memory is reused.
+
+int main() {
+    void* ptr = malloc(100);
+    free(ptr);
+    void* ptr2 = malloc(100);
+    assert(M61_UNTAG(ptr2) == M61_UNTAG(ptr));
+    ptr = realloc(ptr, 200);
+    m61_printstatistics();
+}
+
+//! MEMORY BUG: tagtest???.c:12: invalid free of pointer ???, stale or double free
+//! ???
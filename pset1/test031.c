@@ -0,0 +1,43 @@
+#include "m61.h"
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+// Heap snapshot of active allocations.
+
+int main() {
+    char* ptrs[4];
+    ptrs[0] = (char*) malloc(100);
+    ptrs[1] = (char*) malloc(200);
+    ptrs[2] = (char*) malloc(300);
+    ptrs[3] = (char*) malloc(400);
+    free(ptrs[1]);
+
+    FILE* f = tmpfile();
+    int r = m61_snapshot(fileno(f));
+    assert(r == 0);
+    rewind(f);
+
+    struct m61_snapshot_header header;
+    r = fread(&header, sizeof(header), 1, f);
+    assert(r == 1 && header.magic == M61_SNAPSHOT_MAGIC);
+    printf("SNAPSHOT: %llu total, %llu active\n",
+           (unsigned long long) header.ntotal, (unsigned long long) header.nactive);
+    for (uint64_t i = 0; i < header.nactive; ++i) {
+        struct m61_snapshot_record record;
+        char file[100];
+        r = fread(&record, sizeof(record), 1, f);
+        assert(r == 1 && record.file_len < sizeof(file));
+        r = fread(file, 1, record.file_len, f);
+        assert(r == (int) record.file_len);
+        file[record.file_len] = 0;
+        printf("RECORD: %s:%u: size %llu, age %llu\n", file, record.line,
+               (unsigned long long) record.size, (unsigned long long) record.age);
+    }
+    fclose(f);
+}
+
+//!!SORT
+//! RECORD: test???.c:11: size 300, age 1
+//! RECORD: test???.c:12: size 400, age 0
+//! RECORD: test???.c:9: size 100, age 3
+//! SNAPSHOT: 4 total, 3 active
@@ -0,0 +1,25 @@
+#include "m61.h"
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+// Peak memory report by call site.
+
+int main() {
+    m61_setsampleinterval(2);
+    char* a = (char*) malloc(1000);
+    char* b = (char*) malloc(500);
+    free(a);
+    for (int i = 0; i < 4; ++i)
+        a = (char*) malloc(200);
+    free(b);
+
+    struct m61_statistics stat;
+    m61_getstatistics(&stat);
+    assert(stat.peak_size == 1500);
+    m61_printpeakreport();
+}
+
+//! PEAK: 1500 bytes at allocation 2
+//! PEAK SITE: test???.c:9: 1000 bytes at peak (%~66.67), site peak 1000 bytes
+//! PEAK SITE: test???.c:10: 500 bytes at peak (%~33.33), site peak 500 bytes
+//! ACTIVE SIZE every 2 allocations: 1500 900 1300
@@ -0,0 +1,24 @@
+#include "m61.h"
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+#include <inttypes.h>
+// Aligned allocation, usable size and sized free.
+
+int main() {
+    for (size_t align = 1; align <= 8192; align *= 2) {
+        char* p = (char*) aligned_alloc(align, 100);
+        assert(p && (uintptr_t) p % align == 0);
+        assert(m61_usable_size(p) == 100);
+        memset(p, 'A', 100);
+        if (align % 2)
+            free(p);
+        else
+            free_sized(p, 100);
+    }
+    assert(aligned_alloc(24, 100) == NULL);
+    m61_printstatistics();
+}
+
+//! malloc count: active          0   total         14   fail          1
+//! malloc size:  active          0   total       1400   fail        100
@@ -0,0 +1,14 @@
+#include "m61.h"
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+// Sized free with the wrong size.
+
+int main() {
+    char* p = (char*) aligned_alloc(64, 100);
+    free_sized(p, 90);
+    m61_printstatistics();
+}
+
+//! MEMORY BUG: test???.c:9: free of pointer ??{\w+}?? with size 90, but it has size 100
+//! ???
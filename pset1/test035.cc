@@ -0,0 +1,28 @@
+#include "m61.hh"
+#include <stdio.h>
+#include <assert.h>
+#include <vector>
+// C++ allocations: m61_new, m61_allocator and operator new.
+
+struct alignas(64) block {
+    char data[100];
+};
+
+int main() {
+    int* x = m61_new int(61);
+    block* b = m61_new block;
+    assert((uintptr_t) b % 64 == 0);
+    std::vector<int, m61_allocator<int>> v(m61_allocator<int>{});
+    for (int i = 0; i < 100; ++i)
+        v.push_back(i);
+    v.shrink_to_fit();
+    int* y = new int[25];
+    delete[] y;
+    delete b;
+    m61_printleakreport();
+    (void) x;
+}
+
+//!!SORT
+//! LEAK CHECK: test???.cc:12: allocated object ??{\w+}?? with size 4
+//! LEAK CHECK: test???.cc:15: allocated object ??{\w+}?? with size 400
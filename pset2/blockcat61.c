@@ -1,15 +1,28 @@
 #include "io61.h"
 
-// Usage: ./blockcat61 [-b BLOCKSIZE] [FILE]
+// Usage: ./blockcat61 [-v] [-d] [-b BLOCKSIZE] [FILE]
 //    Copies the input FILE to standard output in blocks.
+//    With -v, each block is read and written as two halves with
+//    io61_readv and io61_writev. With -d, both files use direct I/O
+//    (O_DIRECT) where possible.
 //    Default BLOCKSIZE is 4096.
 
 int main(int argc, char** argv) {
     // Parse arguments
     size_t blocksize = 4096;
-    if (argc >= 3 && strcmp(argv[1], "-b") == 0) {
-        blocksize = strtoul(argv[2], 0, 0);
-        argc -= 2, argv += 2;
+    int vectored = 0, direct = 0;
+    while (argc >= 2) {
+        if (strcmp(argv[1], "-v") == 0) {
+            vectored = 1;
+            argc -= 1, argv += 1;
+        } else if (strcmp(argv[1], "-d") == 0) {
+            direct = O_DIRECT;
+            argc -= 1, argv += 1;
+        } else if (argc >= 3 && strcmp(argv[1], "-b") == 0) {
+            blocksize = strtoul(argv[2], 0, 0);
+            argc -= 2, argv += 2;
+        } else
+            break;
     }
 
     // Allocate buffer, open files
@@ -18,15 +31,29 @@ int main(int argc, char** argv) {
 
     const char* in_filename = argc >= 2 ? argv[1] : NULL;
     io61_profile_begin();
-    io61_file* inf = io61_open_check(in_filename, O_RDONLY);
-    io61_file* outf = io61_fdopen(STDOUT_FILENO, O_WRONLY);
+    io61_file* inf = io61_open_check(in_filename, O_RDONLY | direct);
+    io61_file* outf = io61_fdopen(STDOUT_FILENO, O_WRONLY | direct);
 
     // Copy file data
     while (1) {
-        ssize_t amount = io61_read(inf, buf, blocksize);
-        if (amount <= 0)
-            break;
-        io61_write(outf, buf, amount);
+        ssize_t amount;
+        if (vectored) {
+            struct iovec iov[2] = {
+                { buf, blocksize / 2 },
+                { buf + blocksize / 2, blocksize - blocksize / 2 }
+            };
+            amount = io61_readv(inf, iov, 2);
+            if (amount <= 0)
+                break;
+            iov[0].iov_len = amount < (ssize_t) (blocksize / 2) ? (size_t) amount : blocksize / 2;
+            iov[1].iov_len = amount - iov[0].iov_len;
+            io61_writev(outf, iov, 2);
+        } else {
+            amount = io61_read(inf, buf, blocksize);
+            if (amount <= 0)
+                break;
+            io61_write(outf, buf, amount);
+        }
     }
 
     io61_close(inf);
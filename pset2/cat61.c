@@ -1,13 +1,19 @@
 #include "io61.h"
 
-// Usage: ./cat61 [-s SIZE] [FILE]
+// Usage: ./cat61 [-l | -g] [-s SIZE] [FILE]
 //    Copies the input FILE to standard output one character at a time.
+//    With -l, copies a line at a time with io61_readline; with -g, with
+//    io61_getline.
 
 int main(int argc, char** argv) {
     // Parse arguments
     size_t inf_size = (size_t) -1;
-    while (argc >= 3) {
-        if (strcmp(argv[1], "-s") == 0) {
+    int lines = 0;
+    while (argc >= 2) {
+        if (strcmp(argv[1], "-l") == 0 || strcmp(argv[1], "-g") == 0) {
+            lines = argv[1][1];
+            argc -= 1, argv += 1;
+        } else if (argc >= 3 && strcmp(argv[1], "-s") == 0) {
             inf_size = (size_t) strtoul(argv[2], 0, 0);
             argc -= 2, argv += 2;
         } else
@@ -19,7 +25,25 @@ int main(int argc, char** argv) {
     io61_file* inf = io61_open_check(in_filename, O_RDONLY);
     io61_file* outf = io61_fdopen(STDOUT_FILENO, O_WRONLY);
 
-    while (inf_size > 0) {
+    char* buf = NULL;
+    size_t bufcap = 0;
+    while (lines && inf_size > 0) {
+        const char* line = buf;
+        ssize_t n;
+        if (lines == 'l')
+            n = io61_readline(inf, &line);
+        else
+            n = io61_getline(inf, &buf, &bufcap);
+        if (n <= 0)
+            break;
+        if ((size_t) n > inf_size)
+            n = inf_size;
+        io61_write(outf, lines == 'l' ? line : buf, n);
+        inf_size -= n;
+    }
+    free(buf);
+
+    while (!lines && inf_size > 0) {
         int ch = io61_readc(inf);
         if (ch == EOF)
             break;
@@ -237,7 +237,7 @@ sub read_triallog ($) {
 
 sub maybe_make ($) {
     my($command) = @_;
-    if ($MAKE && $command =~ m<(?:^|[|&;]\s*)./(\S+)>) {
+    if ($MAKE && $command =~ m<(?:^|[|&;]\s*)(?:\w+=\S*\s+)*./(\S+)>) {
         if (system("make -s $1") != 0) {
             print STDERR "${Red}ERROR: Cannot make $1${Off}\n";
             exit 1;
@@ -382,6 +382,23 @@ sub run ($$$%) {
                $tt->{"time"}, $tt->{"utime"}, $tt->{"stime"}, $tt->{"maxrss"},
                $tt->{"medianof"}, $tt->{"medianof"} == 1 ? "" : "s");
         push @runtimes, $tt->{"time"};
+        # I/O counters from io61_profile_end
+        if ($tt->{"reads"} || $tt->{"writes"} || $tt->{"maps"} || $tt->{"copies"}) {
+            printf("I/O:       %d reads, %d writes, %d seeks, %d maps, %d copies; %d hits, %d misses, %d seek misses; %d flushes (%d bytes)\n",
+                   $tt->{"reads"}, $tt->{"writes"}, $tt->{"seeks"}, $tt->{"maps"},
+                   $tt->{"copies"}, $tt->{"hits"}, $tt->{"misses"},
+                   $tt->{"seek_misses"}, $tt->{"flushes"}, $tt->{"flush_bytes"});
+        }
+        if (exists($opt{"min_copies"}) && $tt->{"copies"} < $opt{"min_copies"}) {
+            print "           ${Red}ERROR: ", $tt->{"copies"} + 0,
+                " kernel copies, expected at least ", $opt{"min_copies"}, "${Off}\n";
+            ++$nerror;
+        }
+        # Performance counters, where the kernel allowed them
+        my(@perf) = map {
+            exists($tt->{$_}) ? sprintf("%d %s", $tt->{$_}, $_ =~ tr/_/ /r) : ()
+        } ("cycles", "instructions", "llc_misses", "context_switches", "page_faults");
+        print "PERF:      ", join(", ", @perf), "\n" if @perf;
     }
 
     # print stdio vs. yourcode comparison
@@ -604,6 +621,10 @@ run(20,
     "./stridecat61 -t 2 files/text5meg.txt > files/out.txt",
     "regular medium file, character I/O, 2B stride order");
 
+run(46,
+    "IO61_MAPOUTPUT=1 ./ostridecat61 -p -b 512 -t 65536 files/text5meg.txt > files/out.txt",
+    "regular medium file, 512B block output, 64KB stride order, seeks past end, mapped output");
+
 
 # PIPE FILES, SEQUENTIAL I/O
 
@@ -628,4 +649,244 @@ run(25,
     "piped large file, 1B-4KB block I/O, sequential");
 
 
+# BLOCK CACHE (IO61_NOMAP=1 turns off mappings)
+
+run(26,
+    "IO61_NOMAP=1 ./reordercat61 files/text20meg.txt > files/out.txt",
+    "regular large file, 4KB block I/O, random seek order, block cache");
+
+run(27,
+    "IO61_NOMAP=1 IO61_BLOCKSIZE=4096 IO61_NBLOCKS=4 ./reordercat61 -b 1024 -r 6582 files/text5meg.txt > files/out.txt",
+    "regular medium file, 1KB block I/O, random seek order, 4-block cache");
+
+run(28,
+    "IO61_NOMAP=1 IO61_BLOCKSIZE=4096 IO61_NBLOCKS=4 ./ostridecat61 -p -b 1024 -t 16384 files/text5meg.txt > files/out.txt",
+    "regular medium file, 1KB block output, 16KB stride order, 4-block cache");
+
+run(29,
+    "IO61_NOMAP=1 IO61_BLOCKSIZE=8192 ./reordercat61 -r 6582 files/text20meg.txt > files/out.txt",
+    "regular large file, 4KB block I/O, random seek order, 8KB blocks");
+
+
+# READ-AHEAD (block cache, one run per access pattern)
+
+run(30,
+    "IO61_NOMAP=1 ./blockcat61 files/text20meg.txt > files/out.txt",
+    "regular large file, 4KB block I/O, sequential read-ahead");
+
+run(31,
+    "IO61_NOMAP=1 ./reverse61 files/text5meg.txt > files/out.txt",
+    "regular medium file, character I/O, reverse read-ahead");
+
+run(32,
+    "IO61_NOMAP=1 ./stridecat61 -t 1048576 files/text5meg.txt > files/out.txt",
+    "regular medium file, character I/O, 1MB stride order");
+
+run(33,
+    "IO61_NOMAP=1 ./stridecat61 -t 2 files/text5meg.txt > files/out.txt",
+    "regular medium file, character I/O, 2B stride order");
+
+
+# PREFETCH (IO61_PREFETCH=N sets the # buffers; 0 reads synchronously)
+
+run(34,
+    "cat files/text5meg.txt | IO61_PREFETCH=0 ./cat61 | cat > files/out.txt",
+    "piped medium file, character I/O, no prefetch");
+
+run(35,
+    "cat files/text20meg.txt | IO61_PREFETCH=1 ./blockcat61 -b 1024 | cat > files/out.txt",
+    "piped large file, 1KB block I/O, 1 prefetch buffer");
+
+run(36,
+    "cat files/text20meg.txt | IO61_PREFETCH=16 ./randblockcat61 | cat > files/out.txt",
+    "piped large file, random block I/O, 16 prefetch buffers");
+
+run(37,
+    "cat files/text5meg.txt | IO61_PREFETCH=16 ./blockcat61 -b 131072 | cat > files/out.txt",
+    "piped medium file, 128KB block I/O, 16 prefetch buffers");
+
+
+# IO_URING (IO61_URING=1; IO61_NOMAP=1 keeps regular files off mappings)
+
+run(38,
+    "IO61_URING=1 IO61_NOMAP=1 ./reordercat61 files/text20meg.txt > files/out.txt",
+    "regular large file, 4KB block I/O, random seek order, io_uring");
+
+run(39,
+    "IO61_URING=1 IO61_NOMAP=1 ./reverse61 files/text5meg.txt > files/out.txt",
+    "regular medium file, character I/O, reverse order, io_uring");
+
+run(40,
+    "IO61_URING=1 IO61_NOMAP=1 ./ostridecat61 -p -b 1024 -t 16384 files/text5meg.txt > files/out.txt",
+    "regular medium file, 1KB block I/O, stride order, seek past end, io_uring");
+
+run(41,
+    "IO61_URING=1 IO61_NOMAP=1 ./reordercat61 -b 1024 -r 6582 files/text5meg.txt > files/out.txt",
+    "regular medium file, 1KB block I/O, random seek order, io_uring");
+
+
+# WRITE-BEHIND (IO61_WRITEBEHIND=N bytes of buffers may wait to be written)
+
+run(42,
+    "IO61_WRITEBEHIND=131072 IO61_NOMAP=1 ./ostridecat61 -p -b 1024 -t 16384 files/text5meg.txt > files/out.txt",
+    "regular medium file, 1KB block I/O, stride order, seek past end, write-behind");
+
+run(43,
+    "IO61_WRITEBEHIND=131072 IO61_NOMAP=1 ./reordercat61 files/text20meg.txt > files/out.txt",
+    "regular large file, 4KB block I/O, random seek order, write-behind");
+
+run(44,
+    "IO61_WRITEBEHIND=65536 ./blockcat61 -b 1024 files/text20meg.txt | cat > files/out.txt",
+    "regular large file, 1KB block I/O, piped output, write-behind");
+
+run(45,
+    "IO61_WRITEBEHIND=4096 IO61_NOMAP=1 ./cat61 files/text5meg.txt > files/out.txt",
+    "regular medium file, character I/O, small write-behind limit");
+
+
+# MAPPED OUTPUT (IO61_MAPOUTPUT=1 maps regular output files)
+
+run(47,
+    "IO61_MAPOUTPUT=1 ./ostridecat61 -p -b 1024 -t 1048576 files/text20meg.txt > files/out.txt",
+    "regular large file, 1KB block output, 1MB stride order, seeks past end");
+
+run(48,
+    "IO61_MAPOUTPUT=1 ./reordercat61 -b 1280 -r 23 files/text5meg.txt > files/out.txt",
+    "regular medium file, unaligned 1280B block output, random order");
+
+run(49,
+    "cat files/text20meg.txt | IO61_MAPOUTPUT=1 ./blockcat61 -b 1024 > files/out.txt",
+    "piped large file, 1KB block I/O, output grows mapping");
+
+run(50,
+    "IO61_MAPOUTPUT=1 ./cat61 files/text5meg.txt > files/out.txt",
+    "regular medium file, character output, mapping grows");
+
+
+# KERNEL COPIES
+
+run(51,
+    "./copycat61 files/text20meg.txt > files/out.txt",
+    "regular large file, io61_copy to regular file",
+    "min_copies" => 1);
+
+run(52,
+    "./copycat61 files/text20meg.txt | cat > files/out.txt",
+    "regular large file, io61_copy to pipe",
+    "min_copies" => 1);
+
+run(53,
+    "cat files/text20meg.txt | ./copycat61 -b 4096 | cat > files/out.txt",
+    "piped large file, 4KB io61_copy to pipe",
+    "min_copies" => 1);
+
+
+# VECTORED I/O
+
+run(54,
+    "./blockcat61 -v -b 131072 files/text20meg.txt > files/out.txt",
+    "regular large file, 128KB vectored I/O, sequential");
+
+run(55,
+    "cat files/text20meg.txt | ./blockcat61 -v -b 131072 | cat > files/out.txt",
+    "piped large file, 128KB vectored I/O, sequential");
+
+
+# MAP WINDOW (IO61_MAPWINDOW=N maps inputs larger than N bytes in windows)
+
+run(56,
+    "IO61_MAPWINDOW=1048576 ./cat61 files/text20meg.txt > files/out.txt",
+    "regular large file, character I/O, 1MB map window");
+
+run(57,
+    "IO61_MAPWINDOW=1048576 ./reverse61 files/text5meg.txt > files/out.txt",
+    "regular medium file, character I/O, reverse order, 1MB map window");
+
+run(58,
+    "IO61_MAPWINDOW=1048576 ./stridecat61 -t 1048576 files/text5meg.txt > files/out.txt",
+    "regular medium file, character I/O, 1MB stride order, 1MB map window");
+
+run(59,
+    "IO61_MAPWINDOW=65536 ./reordercat61 files/text20meg.txt > files/out.txt",
+    "regular large file, 4KB block I/O, random seek order, 64KB map window");
+
+
+# ADAPTIVE BLOCK SIZE (block cache; blocks follow the request size)
+
+run(60,
+    "IO61_NOMAP=1 ./blockcat61 -b 262144 files/text20meg.txt > files/out.txt",
+    "regular large file, 256KB block I/O, blocks grow");
+
+run(61,
+    "IO61_NOMAP=1 ./reordercat61 -b 262144 files/text20meg.txt > files/out.txt",
+    "regular large file, 256KB block I/O, random seek order, blocks grow");
+
+run(62,
+    "cat files/text20meg.txt | IO61_PREFETCH=0 ./blockcat61 -b 131072 | cat > files/out.txt",
+    "piped large file, 128KB block I/O, no prefetch, blocks grow");
+
+run(63,
+    "IO61_NOMAP=1 ./randblockcat61 files/text20meg.txt > files/out.txt",
+    "regular large file, random block I/O, block size follows requests");
+
+
+# POSITIONAL I/O
+
+run(64,
+    "./reordercat61 -p files/text20meg.txt > files/out.txt",
+    "regular large file, 4KB positional I/O, random order");
+
+run(69,
+    "./reordercat61 -t 4 files/text20meg.txt > files/out.txt",
+    "regular large file, 4KB positional I/O, 4 threads");
+
+
+# DIRTY EXTENTS (block cache; blocks written in scattered pieces)
+
+run(65,
+    "IO61_NOMAP=1 ./ostridecat61 -b 16 -t 4096 files/text1meg.txt > files/out.txt",
+    "regular small file, 16B block output, 4KB stride order");
+
+run(66,
+    "IO61_NOMAP=1 IO61_BLOCKSIZE=4096 IO61_NBLOCKS=4 ./ostridecat61 -p -b 64 -t 512 files/text1meg.txt > files/out.txt",
+    "regular small file, 64B block output, 512B stride order, 4-block cache");
+
+run(67,
+    "IO61_NOMAP=1 IO61_BLOCKSIZE=65536 IO61_NBLOCKS=4 ./ostridecat61 -b 8 -t 8192 files/text1meg.txt > files/out.txt",
+    "regular small file, 8B block output, 8KB stride order, more extents than a block stashes");
+
+run(68,
+    "IO61_NOMAP=1 ./reordercat61 -b 512 files/text5meg.txt > files/out.txt",
+    "regular medium file, 512B block I/O, random seek order");
+
+
+# LINE I/O
+
+run(70,
+    "./cat61 -l files/text20meg.txt > files/out.txt",
+    "regular large file, io61_readline");
+
+run(71,
+    "cat files/text20meg.txt | ./cat61 -g | cat > files/out.txt",
+    "piped large file, io61_getline");
+
+
+# DIRECT I/O
+
+run(72,
+    "./blockcat61 -d files/text20meg.txt > files/out.txt",
+    "regular large file, 4KB block I/O, O_DIRECT");
+
+run(73,
+    "./blockcat61 -d -b 777 files/binary1meg.bin > files/out.txt",
+    "regular medium binary file, 777B block I/O, O_DIRECT");
+
+
+# PAIRED PIPES (io61_setpair flushes output when a read would block)
+
+run(74,
+    "./pipeexchange61 -a | sort > files/out.txt",
+    "request/response batches over paired pipes");
+
+
 summary();
@@ -0,0 +1,36 @@
+#include "io61.h"
+
+// Usage: ./copycat61 [-b BLOCKSIZE] [FILE]
+//    Copies the input FILE to standard output with io61_copy, BLOCKSIZE
+//    bytes per call. The first 100 bytes are copied with character I/O
+//    to leave data buffered in the io61 caches.
+//    Default BLOCKSIZE is 1048576.
+
+int main(int argc, char** argv) {
+    // Parse arguments
+    size_t blocksize = 1048576;
+    if (argc >= 3 && strcmp(argv[1], "-b") == 0) {
+        blocksize = strtoul(argv[2], 0, 0);
+        argc -= 2, argv += 2;
+    }
+    assert(blocksize > 0);
+
+    const char* in_filename = argc >= 2 ? argv[1] : NULL;
+    io61_profile_begin();
+    io61_file* inf = io61_open_check(in_filename, O_RDONLY);
+    io61_file* outf = io61_fdopen(STDOUT_FILENO, O_WRONLY);
+
+    // Copy file data
+    for (int i = 0; i < 100; ++i) {
+        int ch = io61_readc(inf);
+        if (ch == EOF)
+            break;
+        io61_writec(outf, ch);
+    }
+    while (io61_copy(inf, outf, blocksize) > 0) {
+    }
+
+    io61_close(inf);
+    io61_close(outf);
+    io61_profile_end();
+}
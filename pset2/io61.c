@@ -1,395 +1,3118 @@
+#define _GNU_SOURCE 1
 #include "io61.h"
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <limits.h>
 #include <errno.h>
 #include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/sendfile.h>
 #include <string.h>
-#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <poll.h>
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+# include <linux/io_uring.h>
+# include <sys/syscall.h>
+# define IO61_HAVE_URING 1
+#endif
+
+// io61.c
+//    Buffered I/O on top of a small cache of aligned blocks.
+//
+//    A regular read-only file is mapped into memory in full, or, if it is
+//    large, through a window that slides to follow the reader. On request,
+//    a regular write-only file is mapped shared and written in place,
+//    growing the file and the mapping as needed. Every other file goes
+//    through a cache of `nblocks` blocks of `block_size` bytes, where each
+//    block caches the aligned file range [off, off + block_size). A hash
+//    index finds the block for an offset, and blocks are replaced in
+//    least-recently-used order. On read-only files a block holds `len`
+//    valid bytes; on write-only files it holds the dirty extent being
+//    written, [dirty_first, dirty_last), plus a short sorted list of
+//    earlier, separate dirty extents, all written back in file order when
+//    the block is evicted or flushed. Files that can't seek (pipes) use a
+//    single block as a stream buffer.
+//
+//    The file position is kept as a cursor into the current block:
+//    `cur` is the next byte, and `rlim`/`wlim` bound the bytes that can
+//    be read or written there without calling into the cache.
+//
+//    Seeks feed a simple access-pattern detector. Cache misses on
+//    sequential and reverse scans fill a window of several blocks ahead
+//    of the scan with one system call, doubling the window while the
+//    scan continues; strided and random accesses fill single blocks.
+//    Mapped files pass the pattern on to the kernel with madvise.
+//
+//    Streams being read are prefetched by a helper thread that fills a
+//    small ring of buffers while the application drains the current one.
+//
+//    Seekable files can instead use an io_uring (if the kernel has one):
+//    read-ahead blocks are read asynchronously while the application
+//    uses the block it missed on, and dirty blocks are written back
+//    several per submission. Block memory is registered with the ring.
+//    Anything the ring fails to do is retried synchronously.
+//
+//    The block size starts from what fstat says about the file and then
+//    follows the sizes of the application's requests: refills vote on
+//    the average request size since the last refill, and enough votes
+//    in a row grow the blocks (for large-block copiers) or shrink them
+//    back (for small requests), keeping the cache's total size bounded.
+//
+//    Dirty blocks that are adjacent in the file are written back
+//    together with one vectored write, both on flush and when a block
+//    is evicted.
+//
+//    In locked mode, every call holds a per-file recursive lock, so
+//    threads can share a file; io61_lock groups several calls. Unlocked
+//    files pay one flag test per call.
+//
+//    In write-behind mode, a dirty block is written back by handing its
+//    buffer to a writer thread and continuing with a fresh one. Memory
+//    held by queued buffers is bounded by a configurable limit. The
+//    thread writes queued extents that continue one another with one
+//    vectored write, but scattered extents still cost a write each: the
+//    mode hides write latency from the caller and doesn't save system
+//    calls over ordinary write-back.
+
+#define CACHE_SIZE 32768        // default block size
+#define CACHE_SIZE_MAX (4 << 20) // max block size
+#define CACHE_NBLOCKS 16        // default # blocks for seekable files
+#define CACHE_MIN_NBLOCKS 4     // min # blocks for seekable files
+#define ADAPT_VOTES 4           // # refills that must agree to resize
+#define BLOCK_ALIGN 4096        // alignment of block memory
+#define READAHEAD_MAX 16        // max # blocks in a read-ahead window
+#define PREFETCH_NBUFFERS 3     // default # prefetch buffers for streams
+#define PREFETCH_MAX 16         // max # prefetch buffers
+#define URING_ENTRIES 32        // io_uring submission queue size
+#define WRITEBACK_BATCH 8       // # dirty blocks written back per eviction
+#define MAP_MIN_GROW (1 << 20)  // min growth of a mapped output file
+#define IOV_BATCH 64            // max # iovecs per vectored system call
+#define DIRTY_EXTENTS 16        // max # stashed dirty extents per block
+#define MAP_STEPS 8             // # steps a sequential scan takes per window
+
+// Engine settings. Each default can be overridden at run time by an
+// environment variable of the same name (see io61_getenv), so check.pl
+// can test every engine without a rebuild. IO61_NOMAP=1 reads and
+// writes regular files through the block cache instead of mappings;
+// IO61_BLOCKSIZE=N and IO61_NBLOCKS=N fix the cache geometry;
+// IO61_PREFETCH=N sets the # prefetch buffers for streams (0 = off).
+
+// Use io_uring by default if built with `make IO61_URING=1` or run
+// with IO61_URING=1
+#ifndef IO61_URING
+#define IO61_URING 0
+#endif
+
+// Default write-behind limit in bytes (0 = off); set with
+// `make IO61_WRITEBEHIND=N` or IO61_WRITEBEHIND=N at run time
+#ifndef IO61_WRITEBEHIND
+#define IO61_WRITEBEHIND 0
+#endif
+
+// Map regular output files by default if built with
+// `make IO61_MAPOUTPUT=1` or run with IO61_MAPOUTPUT=1 (see
+// io61_setmapoutput for what a crash leaves behind)
+#ifndef IO61_MAPOUTPUT
+#define IO61_MAPOUTPUT 0
+#endif
+
+// Window size for mapping large inputs; `make IO61_MAPWINDOW=N` (or
+// IO61_MAPWINDOW=N at run time) maps every input larger than N bytes
+// through an N-byte window
+#ifdef IO61_MAPWINDOW
+#define MAP_WINDOW ((size_t) IO61_MAPWINDOW)
+#define MAP_FULL_MAX ((off_t) IO61_MAPWINDOW)
+#else
+#define MAP_WINDOW ((size_t) 64 << 20)
+// Largest input mapped in full: leave most of a 32-bit address space free
+#define MAP_FULL_MAX (sizeof(void*) > 4 ? (off_t) 1 << 30 : (off_t) MAP_WINDOW)
+#endif
+
+// Access patterns
+#define IO61_SEQUENTIAL 0       // forward, in small steps
+#define IO61_REVERSE    1       // backward, in small steps
+#define IO61_STRIDE     2       // by a fixed large distance
+#define IO61_RANDOM     3       // none of the above
+
+
+// io61_extent
+//    A range [first, last) of bytes in a block.
+
+typedef struct io61_extent {
+    size_t first;
+    size_t last;
+} io61_extent;
+
+
+// io61_block
+//    A cached, aligned block of a file.
+
+typedef struct io61_block {
+    unsigned char* data;        // block memory (block_size bytes)
+    off_t off;                  // file offset of data[0]; -1 if unused
+    size_t len;                 // # valid bytes (read-only files)
+    size_t dirty_first;         // dirty extent being written,
+    size_t dirty_last;          //   [dirty_first, dirty_last)
+    unsigned nextents;          // # stashed dirty extents
+    io61_extent extents[DIRTY_EXTENTS + 1]; // stashed dirty extents, in
+                                //   order, neither overlapping nor touching
+    struct io61_block* lru_prev; // more recently used block
+    struct io61_block* lru_next; // less recently used block
+    struct io61_block* hash_next; // next block in hash bucket
+    int pending;                // 1 if io_uring I/O is in flight
+} io61_block;
+
+
+// io61_prefetch
+//    State shared with the prefetch thread of a stream. Buffers
+//    [head, tail) are filled; the thread fills buffer `tail` while the
+//    consumer reads buffer `head`.
+
+typedef struct io61_prefetch {
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;        // signaled when `head` or `tail` changes
+    unsigned head;              // next buffer for the consumer
+    unsigned tail;              // next buffer for the thread
+    unsigned nbuffers;
+    int holding;                // 1 if the consumer is reading `head`
+    int stop;                   // 1 if the thread should stop reading
+    int done;                   // 1 once the thread has stopped
+    int fd;
+    size_t size;                // bytes per buffer
+    unsigned char* buf[PREFETCH_MAX];
+    ssize_t len[PREFETCH_MAX];  // # bytes read: 0 at EOF, -1 on error
+    int err[PREFETCH_MAX];      // errno if `len` is -1
+    io61_block block;           // pseudo-block for buffer `head`
+} io61_prefetch;
+
+
+// io61_wbuf
+//    A buffer queued for the write-behind thread.
+
+typedef struct io61_wbuf {
+    unsigned char* data;        // block memory
+    off_t off;                  // file offset of data[0]
+    unsigned nextents;          // dirty extents, in order
+    io61_extent extents[DIRTY_EXTENTS + 1];
+    struct io61_wbuf* next;
+} io61_wbuf;
+
+
+// io61_writebehind
+//    State shared with the write-behind thread of a file.
+
+typedef struct io61_writebehind {
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t work;        // signaled when a buffer is queued
+    pthread_cond_t space;       // signaled when a buffer is written
+    io61_wbuf* head;            // queue of buffers to write
+    io61_wbuf* tail;
+    io61_wbuf* free;            // written buffers, for reuse
+    size_t queued;              // bytes of buffers queued or in flight
+    size_t limit;               // max `queued`
+    size_t size;                // bytes per buffer
+    int fd;
+    int seekable;               // 1 if writes are positional
+    int stop;                   // 1 if the thread should exit
+    int err;                    // first write error, until reported
+    unsigned long long nwrites; // write system calls, until collected
+    unsigned long long nbytes;  // bytes written, until collected
+} io61_writebehind;
+
+
+// io61_uring
+//    An io_uring and its shared ring mappings.
+
+typedef struct io61_uring {
+    int fd;
+    unsigned* sq_head;          // submission queue
+    unsigned* sq_tail;
+    unsigned* sq_mask;
+    unsigned* sq_array;
+    unsigned sq_entries;
+    struct io_uring_sqe* sqes;
+    unsigned* cq_head;          // completion queue
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    struct io_uring_cqe* cqes;
+    void* sq_ring;
+    size_t sq_ring_size;
+    void* cq_ring;
+    size_t cq_ring_size;
+    unsigned nqueued;           // # entries queued, not yet submitted
+    unsigned ninflight;         // # entries not yet completed
+    int fixed;                  // 1 if block memory is registered
+} io61_uring;
+
+
+// io61_file
+//    Data structure for io61 file wrappers.
+
+struct io61_file {
+    unsigned char* cur;         // next byte to read or write
+    unsigned char* rlim;        // end of readable bytes at `cur`
+    unsigned char* wlim;        // end of writable bytes at `cur`
+    int locking;                // 1 if every call takes `lock`
+                                //   (these four match io61_buffer)
+    io61_block* blk;            // block containing `cur`, or NULL
+    off_t pos;                  // file position if `blk == NULL`
+
+    int fd;
+    int mode;                   // O_RDONLY or O_WRONLY
+    off_t size;                 // file size, or -1 if not regular
+    int ispipe;                 // 1 if `fd` is a pipe
+    int seekable;               // 1 if `fd` supports lseek
+    off_t fdpos;                // kernel file offset; -1 if unknown
+    int direct;                 // 1 if `fd` bypasses the page cache; 2
+                                //   if io61 set O_DIRECT (and clears it)
+    size_t dio_align;           // direct I/O offset and size alignment
+    int bfd;                    // buffered twin of `fd` for unaligned
+                                //   direct writes, or -1
+    int nonblock;               // 1 if `fd` is non-blocking; 2 if io61
+                                //   set O_NONBLOCK (and clears it)
+    io61_file* pair;            // paired input or output, or NULL
+
+    io61_block map;             // pseudo-block for a mapped file; for
+                                //   output, `len` is the file size while
+                                //   writing
+    int mmapped;                // 1 if the file is read or written via `map`
+    size_t map_len;             // bytes mapped at `map.data`
+    size_t map_mark;            // mapped output: where the cursor was
+                                //   placed; bytes after it were written
+    size_t map_end;             // mapped output: end of the bytes written
+    size_t map_window;          // window size for an input mapped in
+                                //   windows, or 0 if mapped in full
+    io61_prefetch* prefetch;    // prefetch thread state, or NULL
+    unsigned prefetch_nbuffers; // # prefetch buffers (0 = off)
+    io61_uring* uring;          // io_uring, or NULL
+    int use_uring;              // 1 if `uring` should be used
+    io61_writebehind* writebehind; // write-behind state, or NULL
+
+    size_t block_size;          // bytes per cache block
+    size_t nblocks;             // # cache blocks
+    io61_block* blocks;         // cache blocks
+    io61_block** buckets;       // hash index of blocks by offset
+    size_t nbuckets;            // # buckets (a power of 2)
+    io61_block* lru_head;       // most recently used block
+    io61_block* lru_tail;       // least recently used block
+    io61_block** flush_order;   // scratch space for io61_flush
+    char* line;                 // io61_readline copy of a split line
+    size_t line_cap;            // bytes allocated at `line`
+    io61_counters stats;        // I/O counters, for io61_stats
+
+    pthread_mutex_t lock;       // recursive lock for io61_lock
+
+    int adaptive;               // 1 if the block size follows requests
+    size_t base_block_size;     // initial block size, from fstat
+    size_t req_count;           // # requests since the last refill
+    size_t req_bytes;           // bytes requested since the last refill
+    int adapt_votes;            // > 0: refills in a row voting to grow;
+                                //   < 0: voting to shrink
+
+    int pattern;                // detected access pattern
+    int pattern_candidate;      // pattern of the last seek
+    off_t pattern_pos;          // position of the last seek
+    off_t pattern_delta;        // distance moved by the last seek
+    off_t pattern_stride;       // stride of the last strided pattern
+    size_t ra_blocks;           // # blocks in the next read-ahead window
+    off_t ra_next;              // block offset expected to miss next
+};
+
+
+_Static_assert(offsetof(io61_file, cur) == offsetof(io61_buffer, cur)
+               && offsetof(io61_file, rlim) == offsetof(io61_buffer, rlim)
+               && offsetof(io61_file, wlim) == offsetof(io61_buffer, wlim)
+               && offsetof(io61_file, locking)
+                  == offsetof(io61_buffer, locking),
+               "io61_file must start with an io61_buffer");
+
+
+// min(a, b)
+// Returns the minimum of a and b
+static inline size_t min(size_t a, size_t b) {
+    return (a < b) ? a : b;
+}
+
+
+// io61_tell(f)
+//    Return the current file position of `f`.
+
+static inline off_t io61_tell(io61_file* f) {
+    return f->blk ? f->blk->off + (f->cur - f->blk->data) : f->pos;
+}
+
+
+// io61_detach(f)
+//    Leave the current block, recording the file position in `f->pos`.
+//    Bytes written at the cursor become part of the block's dirty extent
+//    (or, for a mapped output, extend the bytes written; a cursor that
+//    was only placed by a seek writes nothing).
+
+static void io61_detach(io61_file* f) {
+    io61_block* b = f->blk;
+    if (b) {
+        size_t o = f->cur - b->data;
+        if (f->mode == O_WRONLY && b == &f->map) {
+            if (o > f->map_mark && o > f->map_end)
+                f->map_end = o;
+        } else if (f->mode == O_WRONLY && o > b->dirty_last)
+            b->dirty_last = o;
+        f->pos = b->off + o;
+        f->blk = NULL;
+        f->cur = f->rlim = f->wlim = NULL;
+    }
+}
+
+
+// io61_touch(f, b)
+//    Move cache block `b` to the front of the LRU list.
+
+static void io61_touch(io61_file* f, io61_block* b) {
+    // Pseudo-blocks (mappings, prefetch buffers) are not in the list
+    if (b != f->lru_head && b->lru_prev) {
+        b->lru_prev->lru_next = b->lru_next;
+        if (b->lru_next)
+            b->lru_next->lru_prev = b->lru_prev;
+        else
+            f->lru_tail = b->lru_prev;
+        b->lru_prev = NULL;
+        b->lru_next = f->lru_head;
+        f->lru_head->lru_prev = b;
+        f->lru_head = b;
+    }
+}
+
+
+// io61_attach(f, b, pos)
+//    Make `b`, which contains file position `pos`, the current block.
+
+static void io61_attach(io61_file* f, io61_block* b, off_t pos) {
+    f->blk = b;
+    f->cur = b->data + (pos - b->off);
+    if (f->mode == O_RDONLY)
+        f->rlim = b->data + b->len;
+    else if (b == &f->map) {
+        f->wlim = b->data + b->len;
+        f->map_mark = pos;
+    } else
+        f->wlim = b->data + f->block_size;
+    io61_touch(f, b);
+}
+
+
+// io61_alloc_block(f, b)
+//    Allocate memory for block `b` if it has none. Returns 0 on success
+//    and -1 if out of memory.
+
+static int io61_alloc_block(io61_file* f, io61_block* b) {
+    if (!b->data && posix_memalign((void**) &b->data, BLOCK_ALIGN, f->block_size) != 0) {
+        b->data = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+
+// io61_seek_fd(f, off)
+//    Move the kernel file offset of `f` to `off` unless it is already
+//    there. Returns 0 on success and -1 on error.
+
+static int io61_seek_fd(io61_file* f, off_t off) {
+    if (f->seekable && f->fdpos != off) {
+        ++f->stats.seeks;
+        if (lseek(f->fd, off, SEEK_SET) < 0) {
+            f->fdpos = -1;
+            return -1;
+        }
+        f->fdpos = off;
+    }
+    return 0;
+}
+
+
+// io61_direct_writev_at(f, iov, iovcnt, off)
+//    Write part of `iov` at offset `off` of direct I/O file `f`. O_DIRECT
+//    needs aligned offsets, sizes and memory, so only whole aligned
+//    units go to `fd`; an unaligned head or tail goes through the
+//    buffered descriptor `bfd`. Cache blocks are aligned and `iov`
+//    covers whole blocks' extents, so memory alignment follows from
+//    file alignment. Writes one piece and returns its size, like a
+//    short write.
+
+static ssize_t io61_direct_writev_at(io61_file* f, const struct iovec* iov, int iovcnt, off_t off) {
+    size_t sz = 0;
+    for (int i = 0; i != iovcnt; ++i)
+        sz += iov[i].iov_len;
+    size_t a = f->dio_align, head = (a - off % a) % a;
+    int fd = f->fd;
+    if (head != 0 || sz < a) {
+        // Unaligned piece: up to the next aligned offset
+        sz = head != 0 && head < sz ? head : sz;
+        if (f->bfd < 0) {
+            char name[64];
+            snprintf(name, sizeof(name), "/proc/self/fd/%d", f->fd);
+            f->bfd = open(name, O_WRONLY);
+            if (f->bfd < 0)
+                return -1;
+        }
+        fd = f->bfd;
+    } else
+        sz -= sz % a;
+
+    // Cut `iov` down to `sz` bytes
+    struct iovec v[IOV_BATCH];
+    int n = 0;
+    for (size_t left = sz; left != 0 && n != IOV_BATCH && n != iovcnt; ++n) {
+        v[n].iov_base = iov[n].iov_base;
+        v[n].iov_len = min(iov[n].iov_len, left);
+        left -= v[n].iov_len;
+    }
+    ssize_t w = pwritev(fd, v, n, off);
+    ++f->stats.writes;
+    if (w > 0)
+        f->stats.bytes_written += w;
+    return w;
+}
+
+
+// io61_read_at(f, buf, sz, off)
+// io61_readv_at(f, iov, iovcnt, off)
+// io61_writev_at(f, iov, iovcnt, off)
+//    Read or write up to `sz` bytes at file offset `off` with one system
+//    call. Seekable files use positional I/O, which leaves the kernel
+//    file offset alone; it is brought up to date only when `f` is
+//    flushed or closed. `off` is ignored for files that can't seek.
+//    Reads of direct I/O files must be aligned; writes needn't be.
+
+static ssize_t io61_read_at(io61_file* f, unsigned char* buf, size_t sz, off_t off) {
+    ssize_t n = f->seekable ? pread(f->fd, buf, sz, off) : read(f->fd, buf, sz);
+    ++f->stats.reads;
+    if (n > 0)
+        f->stats.bytes_read += n;
+    return n;
+}
+
+static ssize_t io61_readv_at(io61_file* f, const struct iovec* iov, int iovcnt, off_t off) {
+    ssize_t n = f->seekable ? preadv(f->fd, iov, iovcnt, off) : readv(f->fd, iov, iovcnt);
+    ++f->stats.reads;
+    if (n > 0)
+        f->stats.bytes_read += n;
+    return n;
+}
+
+static ssize_t io61_writev_at(io61_file* f, const struct iovec* iov, int iovcnt, off_t off) {
+    if (f->direct)
+        return io61_direct_writev_at(f, iov, iovcnt, off);
+    ssize_t n = f->seekable ? pwritev(f->fd, iov, iovcnt, off) : writev(f->fd, iov, iovcnt);
+    ++f->stats.writes;
+    if (n > 0)
+        f->stats.bytes_written += n;
+    return n;
+}
+
+
+// io61_poll(fd, events)
+//    Wait until non-blocking descriptor `fd` is ready for `events`
+//    (POLLIN or POLLOUT), after a system call on it returned EAGAIN.
+//    Returns 0 on success and -1 on error.
+
+static int io61_poll(int fd, short events) {
+    struct pollfd p = { .fd = fd, .events = events, .revents = 0 };
+    int r;
+    do {
+        r = poll(&p, 1, -1);
+    } while (r < 0 && errno == EINTR);
+    return r < 0 ? -1 : 0;
+}
+
+
+// io61_wait(f, events)
+//    Wait as io61_poll does for the descriptor of `f`, keeping paired
+//    streams moving. An input about to wait for data first writes back
+//    the bytes buffered for its output, since the peer may need them
+//    before it can reply. (Errors in that write are reported by the
+//    output's next flush.) An output waiting for space reads what
+//    arrives on its input meanwhile, into the free end of the input's
+//    block, in case the peer is itself stuck writing to us.
+
+static int io61_wait(io61_file* f, short events) {
+    if (events == POLLIN && f->pair)
+        (void) io61_flush(f->pair);
+    io61_file* in = events == POLLOUT && f->pair && !f->pair->locking
+        ? f->pair : NULL;
+    while (1) {
+        // Once the input's bytes are consumed, restart its block
+        io61_block* b = in ? in->lru_head : NULL;
+        if (b && in->cur == in->rlim) {
+            off_t pos = io61_tell(in);
+            io61_detach(in);
+            if (io61_alloc_block(in, b) == 0) {
+                b->off = pos;
+                b->len = 0;
+                io61_attach(in, b, pos);
+            }
+        }
+        struct pollfd p[2] = {
+            { .fd = f->fd, .events = events, .revents = 0 },
+            { .fd = in ? in->fd : -1, .events = POLLIN, .revents = 0 }
+        };
+        int np = b && in->blk == b && b->len < in->block_size ? 2 : 1;
+        if (poll(p, np, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        if (p[0].revents)
+            return 0;
+        ssize_t n = io61_read_at(in, b->data + b->len,
+                                 in->block_size - b->len, 0);
+        if (n > 0) {
+            b->len += n;
+            in->rlim = b->data + b->len;
+        } else if (n == 0 || (errno != EINTR && errno != EAGAIN))
+            in = NULL;          // leave end of file or errors for later
+    }
+}
+
+
+// io61_dirty(b)
+//    Return 1 if block `b` has dirty bytes.
+
+static inline int io61_dirty(io61_block* b) {
+    return b->dirty_first < b->dirty_last || b->nextents != 0;
+}
+
+
+// io61_stash_extent(b)
+//    Move the dirty extent being written in block `b` into its list of
+//    stashed extents, merging it with the extents it overlaps or
+//    touches. The list must have room for one more extent.
+
+static void io61_stash_extent(io61_block* b) {
+    size_t first = b->dirty_first, last = b->dirty_last;
+    if (first == last)
+        return;
+    b->dirty_first = b->dirty_last = 0;
+    // Extents [i, j) overlap or touch the new one
+    unsigned i = 0, j;
+    while (i != b->nextents && b->extents[i].last < first)
+        ++i;
+    for (j = i; j != b->nextents && b->extents[j].first <= last; ++j) {
+        first = min(first, b->extents[j].first);
+        last = last > b->extents[j].last ? last : b->extents[j].last;
+    }
+    memmove(&b->extents[i + 1], &b->extents[j],
+            (b->nextents - j) * sizeof(io61_extent));
+    b->extents[i].first = first;
+    b->extents[i].last = last;
+    b->nextents += 1 - (j - i);
+}
+
+
+// io61_writebehind_thread(arg)
+//    Write-behind thread body: take the queued buffers and write them in
+//    order until told to stop. Extents that continue one another in the
+//    file, within or across buffers, go out together in one vectored
+//    write; each buffer returns to the free list once it is written.
+
+static void* io61_writebehind_thread(void* arg) {
+    io61_writebehind* w = (io61_writebehind*) arg;
+    pthread_mutex_lock(&w->mutex);
+    while (1) {
+        while (!w->head && !w->stop)
+            pthread_cond_wait(&w->work, &w->mutex);
+        io61_wbuf* e = w->head;
+        if (!e)
+            break;
+        w->head = NULL;
+        pthread_mutex_unlock(&w->mutex);
+
+        unsigned x = 0;         // next extent of `e` to write
+        while (e) {
+            int err = 0;
+            unsigned long long nwrites = 0, nbytes = 0;
+            // Gather the extents that continue the first one; a stream's
+            // extents always continue one another
+            struct iovec iov[IOV_BATCH];
+            int niov = 0;
+            off_t start = e->off + (x != e->nextents ? e->extents[x].first : 0);
+            off_t end = start;
+            io61_wbuf* ge = e;
+            unsigned gx = x;
+            while (ge && niov != IOV_BATCH) {
+                if (gx == ge->nextents) {
+                    ge = ge->next;
+                    gx = 0;
+                    continue;
+                }
+                io61_extent* ext = &ge->extents[gx];
+                if (w->seekable && ge->off + (off_t) ext->first != end)
+                    break;
+                iov[niov].iov_base = ge->data + ext->first;
+                iov[niov].iov_len = ext->last - ext->first;
+                end = ge->off + ext->last;
+                ++niov;
+                ++gx;
+            }
+
+            ssize_t n = 0;
+            if (niov != 0) {
+                if (w->seekable)
+                    n = pwritev(w->fd, iov, niov, start);
+                else
+                    n = writev(w->fd, iov, niov);
+                ++nwrites;
+                if (n > 0)
+                    nbytes += n;
+                else if (n == 0)
+                    err = EIO;
+                else if (errno == EAGAIN)
+                    err = io61_poll(w->fd, POLLOUT) < 0 ? errno : 0;
+                else if (errno != EINTR)
+                    err = errno;
+            }
+
+            // Consume written bytes; a write error drops the rest of
+            // the failing buffer
+            io61_wbuf* done = NULL;
+            unsigned ndone = 0;
+            int failed = err;
+            while (e && (n > 0 || err || x == e->nextents)) {
+                if (x != e->nextents && !err) {
+                    io61_extent* ext = &e->extents[x];
+                    size_t k = min((size_t) n, ext->last - ext->first);
+                    ext->first += k;
+                    n -= k;
+                    if (ext->first == ext->last)
+                        ++x;
+                    continue;
+                }
+                io61_wbuf* next = e->next;
+                e->next = done;
+                done = e;
+                ++ndone;
+                e = next;
+                x = 0;
+                err = 0;
+            }
+
+            pthread_mutex_lock(&w->mutex);
+            if (failed && !w->err)
+                w->err = failed;
+            w->nwrites += nwrites;
+            w->nbytes += nbytes;
+            while (done) {
+                io61_wbuf* next = done->next;
+                done->next = w->free;
+                w->free = done;
+                done = next;
+            }
+            w->queued -= ndone * w->size;
+            if (ndone)
+                pthread_cond_broadcast(&w->space);
+            pthread_mutex_unlock(&w->mutex);
+        }
+        pthread_mutex_lock(&w->mutex);
+    }
+    pthread_mutex_unlock(&w->mutex);
+    return NULL;
+}
+
+
+// io61_writebehind_queue(f, b)
+//    Hand the dirty extents of block `b` to the write-behind thread,
+//    giving `b` a fresh buffer. Waits while the queue is at its limit.
+//    Returns 0 on success and -1 if out of memory.
+
+static int io61_writebehind_queue(io61_file* f, io61_block* b) {
+    io61_writebehind* w = f->writebehind;
+    pthread_mutex_lock(&w->mutex);
+    while (w->queued && w->queued + w->size > w->limit) {
+        pthread_cond_signal(&w->work);
+        pthread_cond_wait(&w->space, &w->mutex);
+    }
+    io61_wbuf* e = w->free;
+    if (e)
+        w->free = e->next;
+    pthread_mutex_unlock(&w->mutex);
+
+    if (!e) {
+        e = (io61_wbuf*) malloc(sizeof(io61_wbuf));
+        if (!e || posix_memalign((void**) &e->data, BLOCK_ALIGN, w->size) != 0) {
+            free(e);
+            return -1;
+        }
+    }
+    unsigned char* data = e->data;
+    io61_stash_extent(b);
+    e->data = b->data;
+    e->off = b->off;
+    e->nextents = b->nextents;
+    memcpy(e->extents, b->extents, b->nextents * sizeof(io61_extent));
+    e->next = NULL;
+    b->data = data;
+    b->nextents = 0;
+
+    pthread_mutex_lock(&w->mutex);
+    if (w->head)
+        w->tail->next = e;
+    else
+        w->head = e;
+    w->tail = e;
+    w->queued += w->size;
+    // Wake the thread once there is a batch worth writing
+    if (w->queued >= w->limit / 2)
+        pthread_cond_signal(&w->work);
+    pthread_mutex_unlock(&w->mutex);
+    return 0;
+}
+
+
+// io61_writebehind_wait(f)
+//    Wait until the write-behind thread has written every queued buffer,
+//    then collect its counters and free the reusable buffers. Returns 0
+//    on success, or -1 with `errno` set to the first write error since
+//    the last call.
+
+static int io61_writebehind_wait(io61_file* f) {
+    io61_writebehind* w = f->writebehind;
+    pthread_mutex_lock(&w->mutex);
+    while (w->queued) {
+        pthread_cond_signal(&w->work);
+        pthread_cond_wait(&w->space, &w->mutex);
+    }
+    int err = w->err;
+    w->err = 0;
+    f->stats.writes += w->nwrites;
+    f->stats.flushes += w->nwrites;
+    f->stats.bytes_written += w->nbytes;
+    f->stats.flush_bytes += w->nbytes;
+    w->nwrites = w->nbytes = 0;
+    while (w->free) {
+        io61_wbuf* e = w->free;
+        w->free = e->next;
+        free(e->data);
+        free(e);
+    }
+    w->size = f->block_size;
+    pthread_mutex_unlock(&w->mutex);
+    if (err) {
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+
+// io61_writebehind_stop(f)
+//    Wait for queued writes, then stop the write-behind thread. Returns
+//    like io61_writebehind_wait.
+
+static int io61_writebehind_stop(io61_file* f) {
+    io61_writebehind* w = f->writebehind;
+    if (!w)
+        return 0;
+    int r = io61_writebehind_wait(f);
+    int err = errno;
+    pthread_mutex_lock(&w->mutex);
+    w->stop = 1;
+    pthread_cond_signal(&w->work);
+    pthread_mutex_unlock(&w->mutex);
+    pthread_join(w->thread, NULL);
+    pthread_mutex_destroy(&w->mutex);
+    pthread_cond_destroy(&w->work);
+    pthread_cond_destroy(&w->space);
+    free(w);
+    f->writebehind = NULL;
+    errno = err;
+    return r;
+}
+
+
+// io61_flush_run(f, run, n)
+//    Write back the stashed dirty extents of blocks `run[0..n)`, which
+//    are in file order, in file order. Extents that continue one another
+//    in the file, within or across blocks, go out together in one
+//    vectored write. Returns 0 on success and -1 on error, leaving
+//    unwritten bytes dirty.
+
+static int io61_flush_run(io61_file* f, io61_block** run, size_t n) {
+    while (n > 0) {
+        if (run[0]->nextents == 0) {
+            ++run;
+            --n;
+            continue;
+        }
+        // Gather the extents that continue the first one
+        struct iovec iov[IOV_BATCH];
+        int niov = 0;
+        off_t start = run[0]->off + run[0]->extents[0].first, end = start;
+        for (size_t i = 0; i != n && niov != IOV_BATCH; ++i) {
+            io61_block* b = run[i];
+            unsigned e = 0;
+            for (; e != b->nextents && niov != IOV_BATCH
+                     && b->off + (off_t) b->extents[e].first == end; ++e) {
+                iov[niov].iov_base = b->data + b->extents[e].first;
+                iov[niov].iov_len = b->extents[e].last - b->extents[e].first;
+                end = b->off + b->extents[e].last;
+                ++niov;
+            }
+            if (e != b->nextents)
+                break;
+        }
+
+        ssize_t w = io61_writev_at(f, iov, niov, start);
+        ++f->stats.flushes;
+        if (w > 0)
+            f->stats.flush_bytes += w;
+        if (w < 0 && errno == EAGAIN && io61_wait(f, POLLOUT) == 0)
+            continue;
+        if (w == 0 || (w < 0 && errno != EINTR))
+            return -1;
+        // Mark written bytes clean, including part of an extent
+        while (w > 0) {
+            io61_extent* x = &run[0]->extents[0];
+            size_t k = min(w, x->last - x->first);
+            x->first += k;
+            w -= k;
+            if (x->first == x->last) {
+                --run[0]->nextents;
+                memmove(x, x + 1, run[0]->nextents * sizeof(io61_extent));
+            }
+            if (run[0]->nextents == 0) {
+                ++run;
+                --n;
+            }
+        }
+    }
+    return 0;
+}
+
+
+// io61_flush_block(f, b)
+//    Write back the dirty extents of block `b`, or queue them for the
+//    write-behind thread. Returns 0 on success and -1 on error, leaving
+//    any unwritten bytes dirty.
+
+static int io61_flush_block(io61_file* f, io61_block* b) {
+    if (!io61_dirty(b))
+        return 0;
+    if (f->writebehind)
+        return io61_writebehind_queue(f, b);
+    io61_stash_extent(b);
+    return io61_flush_run(f, &b, 1);
+}
+
+
+// io61_continues(f, a, b)
+//    Return 1 if the dirty bytes of block `b` continue those of block
+//    `a` in the file. Stashes both blocks' current extents.
+
+static inline int io61_continues(io61_file* f, io61_block* a, io61_block* b) {
+    io61_stash_extent(a);
+    io61_stash_extent(b);
+    return a->nextents != 0 && b->nextents != 0
+        && a->extents[a->nextents - 1].last == f->block_size
+        && b->extents[0].first == 0
+        && b->off == a->off + (off_t) f->block_size;
+}
+
+
+// io61_hash(f, off)
+//    Return the hash bucket for the block at file offset `off`.
+
+static inline size_t io61_hash(io61_file* f, off_t off) {
+    return ((size_t) (off / f->block_size) * 2654435761U) & (f->nbuckets - 1);
+}
+
+
+// io61_find_block(f, off)
+//    Return the cached block at file offset `off`, or NULL.
+
+static io61_block* io61_find_block(io61_file* f, off_t off) {
+    io61_block* b = f->buckets[io61_hash(f, off)];
+    while (b && b->off != off)
+        b = b->hash_next;
+    return b;
+}
+
+
+// io61_unhash(f, b)
+//    Remove block `b` from the hash index and mark it unused.
+
+static void io61_unhash(io61_file* f, io61_block* b) {
+    if (b->off < 0)
+        return;
+    io61_block** pb = &f->buckets[io61_hash(f, b->off)];
+    while (*pb != b)
+        pb = &(*pb)->hash_next;
+    *pb = b->hash_next;
+    b->hash_next = NULL;
+    b->off = -1;
+    b->len = 0;
+}
+
+
+// io61_uring_start(f)
+// io61_uring_stop(f)
+//    Set up or tear down the io_uring for `f`, whose cache blocks are
+//    then allocated and registered with the ring. io61_uring_start
+//    returns -1 if no io_uring is available.
+
+#if IO61_HAVE_URING
+static void io61_uring_stop(io61_file* f) {
+    io61_uring* u = f->uring;
+    if (u) {
+        if (u->sqes != MAP_FAILED)
+            munmap(u->sqes, u->sq_entries * sizeof(struct io_uring_sqe));
+        if (u->cq_ring != u->sq_ring && u->cq_ring != MAP_FAILED)
+            munmap(u->cq_ring, u->cq_ring_size);
+        if (u->sq_ring != MAP_FAILED)
+            munmap(u->sq_ring, u->sq_ring_size);
+        close(u->fd);
+        free(u);
+        f->uring = NULL;
+    }
+}
+
+
+static int io61_uring_start(io61_file* f) {
+    io61_uring* u = (io61_uring*) calloc(1, sizeof(io61_uring));
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    if (!u || (u->fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &p)) < 0) {
+        free(u);
+        return -1;
+    }
+
+    // Map the rings; new kernels share one mapping for both
+    u->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    u->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if ((p.features & IORING_FEAT_SINGLE_MMAP)
+        && u->cq_ring_size > u->sq_ring_size)
+        u->sq_ring_size = u->cq_ring_size;
+    u->sq_ring = mmap(NULL, u->sq_ring_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+        u->cq_ring = u->sq_ring;
+    else
+        u->cq_ring = mmap(NULL, u->cq_ring_size, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
+    u->sqes = (struct io_uring_sqe*) mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe),
+                                          PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                          u->fd, IORING_OFF_SQES);
+    u->sq_entries = p.sq_entries;
+    f->uring = u;
+    if (u->sq_ring == MAP_FAILED || u->cq_ring == MAP_FAILED
+        || u->sqes == MAP_FAILED) {
+        io61_uring_stop(f);
+        return -1;
+    }
+    unsigned char* sq = (unsigned char*) u->sq_ring;
+    unsigned char* cq = (unsigned char*) u->cq_ring;
+    u->sq_head = (unsigned*) (sq + p.sq_off.head);
+    u->sq_tail = (unsigned*) (sq + p.sq_off.tail);
+    u->sq_mask = (unsigned*) (sq + p.sq_off.ring_mask);
+    u->sq_array = (unsigned*) (sq + p.sq_off.array);
+    u->cq_head = (unsigned*) (cq + p.cq_off.head);
+    u->cq_tail = (unsigned*) (cq + p.cq_off.tail);
+    u->cq_mask = (unsigned*) (cq + p.cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe*) (cq + p.cq_off.cqes);
+
+    // Register block memory, so the kernel needn't map it per request
+    struct iovec* iov = (struct iovec*) malloc(f->nblocks * sizeof(struct iovec));
+    u->fixed = iov != NULL;
+    for (size_t i = 0; u->fixed && i != f->nblocks; ++i) {
+        if (io61_alloc_block(f, &f->blocks[i]) < 0)
+            u->fixed = 0;
+        else {
+            iov[i].iov_base = f->blocks[i].data;
+            iov[i].iov_len = f->block_size;
+        }
+    }
+    if (u->fixed
+        && syscall(__NR_io_uring_register, u->fd, IORING_REGISTER_BUFFERS,
+                   iov, f->nblocks) < 0)
+        u->fixed = 0;
+    free(iov);
+    return 0;
+}
+
+// io61_uring_complete(f)
+//    Process all available completions. A read sets its block's length;
+//    a write marks the bytes written clean. Failed requests leave their
+//    block unread or dirty, to be retried synchronously.
+
+static void io61_uring_complete(io61_file* f) {
+    io61_uring* u = f->uring;
+    unsigned head = *u->cq_head;
+    unsigned tail = __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != tail; ++head) {
+        struct io_uring_cqe* cqe = &u->cqes[head & *u->cq_mask];
+        io61_block* b = (io61_block*) (uintptr_t) (cqe->user_data & ~(uint64_t) 1);
+        b->pending = 0;
+        size_t n = cqe->res > 0 ? cqe->res : 0;
+        if (!(cqe->user_data & 1)) {
+            b->len = n;
+            ++f->stats.reads;
+            f->stats.bytes_read += n;
+        } else {
+            ++f->stats.writes;
+            ++f->stats.flushes;
+            f->stats.bytes_written += n;
+            f->stats.flush_bytes += n;
+            b->dirty_first += n;
+            if (n > 0 && b->dirty_first >= b->dirty_last)
+                b->dirty_first = b->dirty_last = 0;
+        }
+        --u->ninflight;
+    }
+    __atomic_store_n(u->cq_head, head, __ATOMIC_RELEASE);
+}
+
+
+// io61_uring_submit(f, wait)
+//    Submit queued requests and wait for at least `wait` completions.
+
+static void io61_uring_submit(io61_file* f, unsigned wait) {
+    io61_uring* u = f->uring;
+    while (1) {
+        int r = syscall(__NR_io_uring_enter, u->fd, u->nqueued, wait,
+                        wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+        if (r >= 0) {
+            u->nqueued -= r;
+            break;
+        } else if (errno != EINTR && errno != EAGAIN && errno != EBUSY)
+            break;
+        // EAGAIN and EBUSY mean completions must be reaped first
+        io61_uring_complete(f);
+    }
+    io61_uring_complete(f);
+}
+
+
+// io61_uring_queue(f, b, write)
+//    Queue a read of all of block `b`, or a write of its dirty extent.
+
+static void io61_uring_queue(io61_file* f, io61_block* b, int write) {
+    io61_uring* u = f->uring;
+    // Keep completions from overflowing the completion queue
+    while (u->ninflight >= u->sq_entries)
+        io61_uring_submit(f, 1);
+
+    unsigned tail = *u->sq_tail;
+    unsigned idx = tail & *u->sq_mask;
+    struct io_uring_sqe* sqe = &u->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->fd = f->fd;
+    if (write) {
+        sqe->opcode = u->fixed ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+        sqe->addr = (uintptr_t) (b->data + b->dirty_first);
+        sqe->len = b->dirty_last - b->dirty_first;
+        sqe->off = b->off + b->dirty_first;
+    } else {
+        sqe->opcode = u->fixed ? IORING_OP_READ_FIXED : IORING_OP_READ;
+        sqe->addr = (uintptr_t) b->data;
+        sqe->len = f->block_size;
+        sqe->off = b->off;
+        b->len = 0;
+    }
+    sqe->buf_index = b - f->blocks;
+    sqe->user_data = (uintptr_t) b | (write ? 1 : 0);
+    u->sq_array[idx] = idx;
+    __atomic_store_n(u->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ++u->nqueued;
+    ++u->ninflight;
+    b->pending = 1;
+}
+
+
+// io61_uring_wait(f, b)
+//    Wait for in-flight I/O on block `b`, or on every block if `b` is
+//    NULL.
+
+static void io61_uring_wait(io61_file* f, io61_block* b) {
+    while (b ? b->pending : f->uring->ninflight != 0)
+        io61_uring_submit(f, 1);
+}
+
+
+// io61_uring_writeback(f, max)
+//    Write back up to `max` dirty blocks, least recently used first,
+//    with one submission, and wait for the writes to complete.
+
+static void io61_uring_writeback(io61_file* f, size_t max) {
+    for (io61_block* b = f->lru_tail; b && max; b = b->lru_prev)
+        // Blocks with stashed extents are written back synchronously
+        if (b != f->blk && !b->pending && b->dirty_first < b->dirty_last
+            && b->nextents == 0) {
+            io61_uring_queue(f, b, 1);
+            --max;
+        }
+    io61_uring_wait(f, NULL);
+}
+#else
+static int io61_uring_start(io61_file* f) {
+    (void) f;
+    return -1;
+}
+static void io61_uring_stop(io61_file* f) {
+    (void) f;
+}
+static void io61_uring_queue(io61_file* f, io61_block* b, int write) {
+    (void) f, (void) b, (void) write;
+}
+static void io61_uring_wait(io61_file* f, io61_block* b) {
+    (void) f, (void) b;
+}
+static void io61_uring_writeback(io61_file* f, size_t max) {
+    (void) f, (void) max;
+}
+#endif
+
+
+// io61_compare_off(a, b)
+//    qsort comparator: blocks in increasing file offset order.
+
+static int io61_compare_off(const void* a, const void* b) {
+    off_t oa = (*(io61_block* const*) a)->off, ob = (*(io61_block* const*) b)->off;
+    return oa < ob ? -1 : (oa > ob ? 1 : 0);
+}
+
+
+// io61_flush_sorted(f)
+//    Write back every dirty extent of seekable file `f` in file order,
+//    each run of adjacent extents with one vectored write. Returns 0 on
+//    success and -1 on error.
+
+static int io61_flush_sorted(io61_file* f) {
+    size_t n = 0;
+    for (size_t i = 0; i != f->nblocks; ++i)
+        if (io61_dirty(&f->blocks[i])) {
+            io61_stash_extent(&f->blocks[i]);
+            f->flush_order[n++] = &f->blocks[i];
+        }
+    qsort(f->flush_order, n, sizeof(io61_block*), io61_compare_off);
+    return io61_flush_run(f, f->flush_order, n);
+}
+
+
+// io61_flush_around(f, b)
+//    Write back block `b` together with the cached dirty blocks around
+//    it that continue its dirty extent, so a sequential writer pays one
+//    system call for a run of blocks rather than one per block. The
+//    other blocks stay cached, clean.
+
+static int io61_flush_around(io61_file* f, io61_block* b) {
+    if (!io61_dirty(b) || f->writebehind || f->uring)
+        return io61_flush_block(f, b);
+    io61_stash_extent(b);
+    io61_block* run[IOV_BATCH];
+    size_t first = IOV_BATCH / 2, last = first + 1;
+    run[first] = b;
+    io61_block* x;
+    while (first > 0 && run[first]->off > 0
+           && (x = io61_find_block(f, run[first]->off - f->block_size))
+           && io61_continues(f, x, run[first]))
+        run[--first] = x;
+    while (last < IOV_BATCH
+           && (x = io61_find_block(f, run[last - 1]->off + f->block_size))
+           && io61_continues(f, run[last - 1], x)) {
+        run[last] = x;
+        ++last;
+    }
+    return io61_flush_run(f, run + first, last - first);
+}
+
+
+// io61_take_block(f, off)
+//    Evict the least recently used block and reuse it for file offset
+//    `off`, moving it to the front of the LRU list. Returns NULL if the
+//    evicted block's dirty data could not be written back.
+
+static io61_block* io61_take_block(io61_file* f, off_t off) {
+    io61_block* b = f->lru_tail;
+    if (f->uring) {
+        io61_uring_wait(f, b);
+        if (io61_dirty(b))
+            io61_uring_writeback(f, WRITEBACK_BATCH);
+    }
+    // A random writer evicting dirty data writes back the whole cache
+    // in file order, so the disk sees a near-sequential pass
+    if (f->pattern == IO61_RANDOM && io61_dirty(b) && !f->writebehind
+        && !f->uring && io61_flush_sorted(f) < 0)
+        return NULL;
+    if (io61_alloc_block(f, b) < 0 || io61_flush_around(f, b) < 0)
+        return NULL;
+    io61_unhash(f, b);
+    b->off = off;
+    size_t h = io61_hash(f, off);
+    b->hash_next = f->buckets[h];
+    f->buckets[h] = b;
+    io61_touch(f, b);
+    return b;
+}
+
+
+// io61_fill_block(f, b)
+//    Read more of block `b` from the file, up to its full size. Returns
+//    the number of bytes added, 0 at end of file, or -1 on error.
+
+static ssize_t io61_fill_block(io61_file* f, io61_block* b) {
+    while (1) {
+        // Direct I/O re-reads from the last aligned offset
+        size_t len = b->len;
+        size_t from = f->direct ? len - len % f->dio_align : len;
+        ssize_t n = io61_read_at(f, b->data + from, f->block_size - from,
+                                 b->off + from);
+        if (n > 0 && from + n > len) {
+            n = from + n - len;
+            b->len += n;
+        } else if (n > 0)
+            n = 0;
+        if (n >= 0
+            || (errno != EINTR
+                && (errno != EAGAIN || io61_wait(f, POLLIN) < 0)))
+            return n;
+        // The paired output may have read into `b` while we waited
+        if (b->len != len)
+            return b->len - len;
+    }
+}
+
+
+// io61_observe(f, pos)
+//    Update the access pattern of `f` for a seek to `pos`. A new pattern
+//    takes effect after two consecutive seeks agree on it, so a single
+//    odd seek does not flip it.
+
+static void io61_observe(io61_file* f, off_t pos) {
+    off_t delta = pos - f->pattern_pos;
+    f->pattern_pos = pos;
+    // Fast path: the same move as last time, in the established pattern
+    if (delta == 0
+        || (delta == f->pattern_delta && f->pattern_candidate == f->pattern))
+        return;
+    int p;
+    if (delta > 0 && delta < (off_t) f->block_size)
+        p = IO61_SEQUENTIAL;
+    else if (delta < 0 && -delta < (off_t) f->block_size)
+        p = IO61_REVERSE;
+    else if (delta == f->pattern_delta || delta == f->pattern_stride)
+        p = IO61_STRIDE;
+    else
+        p = IO61_RANDOM;
+    f->pattern_delta = delta;
+
+    if (p != f->pattern_candidate)
+        f->pattern_candidate = p;
+    else if (p != f->pattern) {
+        f->pattern = p;
+        // Remember the stride, so wrapping around the file (as
+        // stridecat61 does) doesn't lose it
+        if (p == IO61_STRIDE)
+            f->pattern_stride = delta;
+        // Tell the kernel how the mapping will be used
+        if (f->mmapped && f->mode == O_RDONLY && f->map.data) {
+            int advice = MADV_NORMAL;
+            if (p == IO61_SEQUENTIAL)
+                advice = MADV_SEQUENTIAL;
+            else if (p == IO61_RANDOM)
+                advice = MADV_RANDOM;
+            (void) madvise(f->map.data, f->map_len, advice);
+        }
+    }
+}
+
+
+// io61_fill_window(f, off)
+//    Read the block at file offset `off`, plus any read-ahead blocks
+//    the access pattern calls for, with one system call. Sequential
+//    scans read ahead after `off`; reverse scans read ahead before it,
+//    so the current position ends up at the end of the window. Returns
+//    the number of bytes read, 0 at end of file, or -1 on error.
+
+static ssize_t io61_fill_window(io61_file* f, off_t off) {
+    off_t bs = f->block_size;
+
+    // Grow the window while the scan keeps missing where expected
+    size_t max = f->nblocks / 2 < READAHEAD_MAX ? f->nblocks / 2 : READAHEAD_MAX;
+    if ((f->pattern == IO61_SEQUENTIAL || f->pattern == IO61_REVERSE)
+        && off == f->ra_next)
+        f->ra_blocks = min(2 * f->ra_blocks, max ? max : 1);
+    else
+        f->ra_blocks = 1;
+
+    // Extend [lo, hi) over uncached blocks in the scan direction
+    off_t lo = off, hi = off + bs;
+    size_t n = 1;
+    if (f->pattern == IO61_SEQUENTIAL)
+        for (; n < f->ra_blocks && (f->size < 0 || hi < f->size)
+                 && !io61_find_block(f, hi); ++n)
+            hi += bs;
+    else if (f->pattern == IO61_REVERSE)
+        for (; n < f->ra_blocks && lo > 0 && !io61_find_block(f, lo - bs); ++n)
+            lo -= bs;
+    f->ra_next = f->pattern == IO61_REVERSE ? lo - bs : hi;
+
+    struct iovec iov[READAHEAD_MAX];
+    io61_block* blocks[READAHEAD_MAX];
+    for (size_t i = 0; i != n; ++i) {
+        if (!(blocks[i] = io61_take_block(f, lo + i * bs)))
+            return -1;
+        iov[i].iov_base = blocks[i]->data;
+        iov[i].iov_len = bs;
+    }
+
+    // With an io_uring, wait only for the block at `off`; the others
+    // complete in the background
+    if (f->uring) {
+        for (size_t i = 0; i != n; ++i)
+            io61_uring_queue(f, blocks[i], 0);
+        io61_block* b = blocks[(off - lo) / bs];
+        io61_uring_wait(f, b);
+        return b->len;
+    }
+
+    ssize_t r;
+    do {
+        r = io61_readv_at(f, iov, n, lo);
+    } while (r < 0 && (errno == EINTR || errno == EAGAIN));
+
+    // Hand out the bytes read; read-ahead blocks that got none are dropped
+    for (size_t i = 0; i != n; ++i) {
+        off_t left = r > 0 ? r - (off_t) i * bs : 0;
+        blocks[i]->len = left <= 0 ? 0 : min(left, bs);
+        if (blocks[i]->len == 0 && blocks[i]->off != off)
+            io61_unhash(f, blocks[i]);
+    }
+    return r;
+}
+
+
+// io61_prefetch_unlock(arg)
+//    Cancellation cleanup handler for the prefetch thread.
+
+static void io61_prefetch_unlock(void* arg) {
+    pthread_mutex_unlock((pthread_mutex_t*) arg);
+}
+
+
+// io61_prefetch_thread(arg)
+//    Prefetch thread body: fill buffers until end of file, error, or a
+//    stop request (see io61_prefetch_halt). The thread is canceled if
+//    the file is closed first.
+
+static void* io61_prefetch_thread(void* arg) {
+    io61_prefetch* p = (io61_prefetch*) arg;
+    ssize_t n;
+    int stop;
+    do {
+        pthread_mutex_lock(&p->mutex);
+        pthread_cleanup_push(io61_prefetch_unlock, &p->mutex);
+        while (p->tail - p->head == p->nbuffers && !p->stop)
+            pthread_cond_wait(&p->cond, &p->mutex);
+        stop = p->stop;
+        pthread_cleanup_pop(1);
+        if (stop)
+            break;
+
+        unsigned slot = p->tail % p->nbuffers;
+        do {
+            n = read(p->fd, p->buf[slot], p->size);
+        } while (n < 0 && (errno == EINTR
+                           || (errno == EAGAIN && io61_poll(p->fd, POLLIN) == 0)));
+
+        pthread_mutex_lock(&p->mutex);
+        p->len[slot] = n;
+        p->err[slot] = n < 0 ? errno : 0;
+        ++p->tail;
+        pthread_cond_signal(&p->cond);
+        pthread_mutex_unlock(&p->mutex);
+    } while (n > 0);
+
+    pthread_mutex_lock(&p->mutex);
+    p->done = 1;
+    pthread_cond_signal(&p->cond);
+    pthread_mutex_unlock(&p->mutex);
+    return NULL;
+}
+
+
+// io61_prefetch_start(f)
+//    Start the prefetch thread for stream `f`. Returns 0 on success and
+//    -1 on failure, in which case `f` is read synchronously.
+
+static int io61_prefetch_start(io61_file* f) {
+    io61_prefetch* p = (io61_prefetch*) calloc(1, sizeof(io61_prefetch));
+    if (!p)
+        return -1;
+    p->nbuffers = f->prefetch_nbuffers;
+    p->fd = f->fd;
+    p->size = f->block_size;
+    pthread_mutex_init(&p->mutex, NULL);
+    pthread_cond_init(&p->cond, NULL);
+    for (unsigned i = 0; i != p->nbuffers; ++i)
+        if (posix_memalign((void**) &p->buf[i], BLOCK_ALIGN, p->size) != 0)
+            goto fail;
+    if (pthread_create(&p->thread, NULL, io61_prefetch_thread, p) != 0)
+        goto fail;
+    f->prefetch = p;
+    return 0;
+
+ fail:
+    for (unsigned i = 0; i != p->nbuffers; ++i)
+        free(p->buf[i]);
+    free(p);
+    f->prefetch_nbuffers = 0;
+    return -1;
+}
+
+
+// io61_prefetch_stop(f)
+//    Stop the prefetch thread of `f` and free its buffers.
+
+static void io61_prefetch_stop(io61_file* f) {
+    io61_prefetch* p = f->prefetch;
+    if (p) {
+        pthread_cancel(p->thread);
+        pthread_join(p->thread, NULL);
+        pthread_mutex_destroy(&p->mutex);
+        pthread_cond_destroy(&p->cond);
+        for (unsigned i = 0; i != p->nbuffers; ++i)
+            free(p->buf[i]);
+        free(p);
+        f->prefetch = NULL;
+    }
+}
+
+
+// io61_prefetch_halt(f)
+//    Ask the prefetch thread of `f` to stop once its current read is
+//    done. The buffers it has filled are still read in order; after the
+//    last one, the thread is stopped and `f` is read synchronously.
+
+static void io61_prefetch_halt(io61_file* f) {
+    io61_prefetch* p = f->prefetch;
+    pthread_mutex_lock(&p->mutex);
+    p->stop = 1;
+    pthread_cond_signal(&p->cond);
+    pthread_mutex_unlock(&p->mutex);
+}
+
+
+// io61_prefetch_fill(f, pos)
+//    Release the buffer the consumer has finished with and make the next
+//    prefetched buffer current at file position `pos`. Returns 1 if data
+//    is available, 0 at end of file, and -1 on error. If a halted thread
+//    has no more buffers, stops it and returns 0 with `f->prefetch` NULL.
+
+static int io61_prefetch_fill(io61_file* f, off_t pos) {
+    io61_prefetch* p = f->prefetch;
+    pthread_mutex_lock(&p->mutex);
+    if (p->holding) {
+        ++p->head;
+        p->holding = 0;
+        pthread_cond_signal(&p->cond);
+    }
+    while (p->head == p->tail && !p->done)
+        pthread_cond_wait(&p->cond, &p->mutex);
+    if (p->head == p->tail) {
+        pthread_mutex_unlock(&p->mutex);
+        io61_prefetch_stop(f);
+        f->prefetch_nbuffers = 0;
+        return 0;
+    }
+    unsigned slot = p->head % p->nbuffers;
+    ssize_t n = p->len[slot];
+    // End of file and errors stay at `head`, so they repeat
+    p->holding = n > 0;
+    pthread_mutex_unlock(&p->mutex);
+    ++f->stats.reads;
+    ++f->stats.misses;
+    if (n > 0)
+        f->stats.bytes_read += n;
+
+    if (n <= 0) {
+        errno = p->err[slot];
+        return n;
+    }
+    p->block.data = p->buf[slot];
+    p->block.off = pos;
+    p->block.len = n;
+    io61_attach(f, &p->block, pos);
+    return 1;
+}
+
+
+// io61_resize_cache(f, block_size, nblocks)
+//    Change the cache geometry of `f` to `nblocks` blocks of `block_size`
+//    bytes (a multiple of 4096). Files that can't seek always use one
+//    block. Buffered data is flushed first. Fails once a prefetch thread
+//    is running. Returns 0 on success and -1 on error.
+
+static int io61_resize_cache(io61_file* f, size_t block_size, size_t nblocks) {
+    if (block_size == 0 || block_size % BLOCK_ALIGN != 0 || nblocks == 0)
+        return -1;
+    if (!f->seekable)
+        nblocks = 1;
+    if (f->prefetch)
+        return -1;
+
+    // Allocate the new cache first: on failure, the old one stays
+    size_t nbuckets = 1;
+    while (nbuckets < 2 * nblocks)
+        nbuckets *= 2;
+    io61_block* blocks = (io61_block*) calloc(nblocks, sizeof(io61_block));
+    io61_block** buckets = (io61_block**) calloc(nbuckets, sizeof(io61_block*));
+    io61_block** flush_order = (io61_block**) calloc(nblocks, sizeof(io61_block*));
+    if (!blocks || !buckets || !flush_order
+        || (f->blocks && io61_flush(f) < 0)) {
+        free(blocks);
+        free(buckets);
+        free(flush_order);
+        return -1;
+    }
+
+    if (f->blocks) {
+        io61_detach(f);
+        if (f->uring) {
+            io61_uring_wait(f, NULL);
+            io61_uring_stop(f);
+        }
+        for (size_t i = 0; i < f->nblocks; ++i)
+            free(f->blocks[i].data);
+        free(f->blocks);
+        free(f->buckets);
+        free(f->flush_order);
+    }
+
+    f->block_size = block_size;
+    f->nblocks = nblocks;
+    if (f->writebehind)
+        f->writebehind->size = block_size;
+    f->blocks = blocks;
+    f->nbuckets = nbuckets;
+    f->buckets = buckets;
+    f->flush_order = flush_order;
+
+    // Initially every block is unused, in LRU order
+    for (size_t i = 0; i < nblocks; ++i) {
+        f->blocks[i].off = -1;
+        f->blocks[i].lru_prev = i ? &f->blocks[i - 1] : NULL;
+        f->blocks[i].lru_next = i + 1 < nblocks ? &f->blocks[i + 1] : NULL;
+    }
+    f->lru_head = &f->blocks[0];
+    f->lru_tail = &f->blocks[nblocks - 1];
+    if (f->use_uring && io61_uring_start(f) < 0)
+        f->use_uring = 0;
+    return 0;
+}
+
+
+// io61_cache_nblocks(f, block_size)
+//    Return the number of blocks a seekable file's cache should have for
+//    blocks of `block_size` bytes: CACHE_NBLOCKS, or fewer for large
+//    blocks, so the cache stays near its default total size.
+
+static size_t io61_cache_nblocks(io61_file* f, size_t block_size) {
+    if (!f->seekable)
+        return 1;
+    size_t n = (size_t) CACHE_SIZE * CACHE_NBLOCKS / block_size;
+    return n < CACHE_MIN_NBLOCKS ? CACHE_MIN_NBLOCKS
+        : (n > CACHE_NBLOCKS ? CACHE_NBLOCKS : n);
+}
+
+
+// io61_initial_block_size(f, s)
+//    Choose the initial block size for `f` from its fstat information
+//    `s`: a pipe's capacity for pipes; at least the preferred I/O size
+//    for regular files, but no more than a small input needs.
+
+static size_t io61_initial_block_size(io61_file* f, const struct stat* s) {
+    size_t bs = CACHE_SIZE;
+    if (S_ISFIFO(s->st_mode)) {
+        int cap = fcntl(f->fd, F_GETPIPE_SZ);
+        if (cap > 0)
+            bs = cap;
+    } else if (S_ISREG(s->st_mode)) {
+        if ((size_t) s->st_blksize > bs)
+            bs = s->st_blksize;
+        if (f->mode == O_RDONLY && (size_t) s->st_size < bs)
+            bs = s->st_size;
+    }
+    bs = (bs + BLOCK_ALIGN - 1) & ~(size_t) (BLOCK_ALIGN - 1);
+    return bs < BLOCK_ALIGN ? BLOCK_ALIGN
+        : (bs > CACHE_SIZE_MAX ? CACHE_SIZE_MAX : bs);
+}
+
+
+// io61_adapt(f)
+//    Called at each refill: vote on the block size using the requests
+//    made since the last refill, and resize the cache once ADAPT_VOTES
+//    refills in a row agree. A refill with no new request is in the
+//    middle of a large one and doesn't vote. Blocks grow to fit the
+//    average request, and shrink by halves (not below their initial
+//    size) while requests are much smaller than a block.
+
+static void io61_adapt(io61_file* f) {
+    size_t n = f->req_count, avg = n ? f->req_bytes / n : 0;
+    f->req_count = f->req_bytes = 0;
+    if (!f->adaptive || f->mmapped || f->prefetch || n == 0)
+        return;
+
+    size_t bs = f->block_size;
+    if (avg > bs && bs < CACHE_SIZE_MAX)
+        f->adapt_votes = f->adapt_votes > 0 ? f->adapt_votes + 1 : 1;
+    else if (avg < bs / 16 && bs > f->base_block_size)
+        f->adapt_votes = f->adapt_votes < 0 ? f->adapt_votes - 1 : -1;
+    else
+        f->adapt_votes = 0;
+
+    if (f->adapt_votes >= ADAPT_VOTES) {
+        while (bs < avg && bs < CACHE_SIZE_MAX)
+            bs *= 2;
+    } else if (f->adapt_votes <= -ADAPT_VOTES)
+        bs = bs / 2 > f->base_block_size ? bs / 2 : f->base_block_size;
+    else
+        return;
+    bs = bs > CACHE_SIZE_MAX ? CACHE_SIZE_MAX : bs;
+    bs = (bs + BLOCK_ALIGN - 1) & ~(size_t) (BLOCK_ALIGN - 1);
+    f->adapt_votes = 0;
+    if (bs != f->block_size)
+        io61_resize_cache(f, bs, io61_cache_nblocks(f, bs));
+}
+
+
+// io61_map_window(f, pos)
+//    Make sure the input mapping window of `f` covers file position
+//    `pos`, sliding it if necessary. Only scans slide the window: a
+//    sequential scan gets a window starting at `pos` and a reverse scan
+//    one ending just after it, while strided and random accesses would
+//    remap on nearly every miss and so use the block cache. Returns 1
+//    if the window covers `pos` and 0 if not. If a window can't be
+//    mapped, `f` stops using a mapping.
+
+static int io61_map_window(io61_file* f, off_t pos) {
+    if (f->map.data && pos >= f->map.off
+        && pos < f->map.off + (off_t) f->map.len)
+        return 1;
+    if (f->pattern != IO61_SEQUENTIAL && f->pattern != IO61_REVERSE)
+        return 0;
+    off_t w = f->map_window;
+    off_t start = f->pattern == IO61_SEQUENTIAL ? pos : pos + 1 - w;
+    if (start > f->size - w)
+        start = f->size - w;
+    if (start < 0)
+        start = 0;
+    start -= start % BLOCK_ALIGN;
+    size_t len = min(w, f->size - start);
+
+    // Unmapping the old window drops its pages from our address space
+    if (f->map.data) {
+        munmap(f->map.data, f->map_len);
+        ++f->stats.maps;
+    }
+    void* memory = mmap(NULL, len, PROT_READ, MAP_PRIVATE, f->fd, start);
+    ++f->stats.maps;
+    if (memory == MAP_FAILED) {
+        f->map.data = NULL;
+        f->map.len = f->map_len = 0;
+        f->mmapped = 0;
+        return 0;
+    }
+    f->map.data = (unsigned char*) memory;
+    f->map.off = start;
+    f->map.len = f->map_len = len;
+    (void) madvise(memory, len, f->pattern == IO61_SEQUENTIAL ? MADV_SEQUENTIAL : MADV_NORMAL);
+    return 1;
+}
+
+
+// io61_map_step(f, pos)
+//    A sequential scan reads a window in MAP_STEPS steps: the read
+//    cursor stops at the end of each step, so the reader comes back here
+//    to ask for the next step to be read ahead and the previous step to
+//    be dropped. RSS stays near two steps however large the file.
+
+static void io61_map_step(io61_file* f, off_t pos) {
+    size_t step = f->map.len / MAP_STEPS;
+    step -= step % BLOCK_ALIGN;
+    if (f->pattern != IO61_SEQUENTIAL || step == 0)
+        return;
+    size_t s = pos - f->map.off;
+    s -= s % step;
+    f->rlim = f->map.data + min(s + step, f->map.len);
+    if (s + step < f->map.len)
+        (void) madvise(f->map.data + s + step, min(step, f->map.len - s - step),
+                       MADV_WILLNEED);
+    if (s >= step)
+        (void) madvise(f->map.data + s - step, step, MADV_DONTNEED);
+}
+
+
+// io61_fill(f)
+//    Refill the read cursor so it points at data for the current file
+//    position. Returns 1 if data is available, 0 at end of file, and -1
+//    on error.
+
+static int io61_fill(io61_file* f) {
+    off_t pos = io61_tell(f);
+    io61_detach(f);
+    io61_adapt(f);
+
+    // Mapped file: only the end of the file remains. Positions outside a
+    // windowed mapping may be read through the block cache instead.
+    if (f->mmapped && pos >= f->size)
+        return 0;
+    if (f->mmapped && (!f->map_window || io61_map_window(f, pos))) {
+        ++f->stats.hits;
+        io61_attach(f, &f->map, pos);
+        if (f->map_window)
+            io61_map_step(f, pos);
+        return 1;
+    }
+
+    // Stream with a prefetch thread, started on first use
+    if (!f->seekable && f->prefetch_nbuffers
+        && (f->prefetch || io61_prefetch_start(f) == 0)) {
+        int r = io61_prefetch_fill(f, pos);
+        if (f->prefetch)
+            return r;
+    }
+
+    io61_block* b;
+    int cached = 0;
+    if (!f->seekable) {
+        // Stream: reuse the single block for the next bytes
+        b = f->lru_head;
+        if (io61_alloc_block(f, b) < 0)
+            return -1;
+        b->off = pos;
+        b->len = 0;
+    } else {
+        off_t off = pos - pos % f->block_size;
+        b = io61_find_block(f, off);
+        cached = b != NULL;
+        if (!b) {
+            ++f->stats.misses;
+            if (io61_fill_window(f, off) < 0)
+                return -1;
+            b = io61_find_block(f, off);
+        } else if (b->pending)
+            io61_uring_wait(f, b);
+        if (pos < b->off + (off_t) b->len) {
+            f->stats.hits += cached;
+            io61_attach(f, b, pos);
+            return 1;
+        }
+    }
+    if (!f->seekable || cached)
+        ++f->stats.misses;
+
+    // Read the block until it covers `pos` (a block previously cut short
+    // by end of file may have grown)
+    while (pos >= b->off + (off_t) b->len) {
+        ssize_t n = io61_fill_block(f, b);
+        if (n <= 0) {
+            if (b->len == 0 && f->seekable)
+                io61_unhash(f, b);
+            return n;
+        }
+    }
+    io61_attach(f, b, pos);
+    return 1;
+}
+
+
+// io61_map_output(f)
+//    Map write-only regular file `f` shared, so writes go straight into
+//    the page cache. The mapping needs a readable descriptor, so the
+//    file is reopened for reading and writing. Returns 0 on success and
+//    -1 if the file can't be mapped.
+
+static int io61_map_output(io61_file* f) {
+    int flags = fcntl(f->fd, F_GETFL);
+    if (f->size < 0 || !f->seekable || flags < 0 || (flags & O_APPEND))
+        return -1;
+    char name[64];
+    snprintf(name, sizeof(name), "/proc/self/fd/%d", f->fd);
+    int fd = open(name, O_RDWR);
+    if (fd < 0)
+        return -1;
+
+    // Reserve room to grow; only the file's extent is ever touched
+    size_t len = f->size > MAP_MIN_GROW ? (size_t) f->size : MAP_MIN_GROW;
+    len = (len + BLOCK_ALIGN - 1) & ~(size_t) (BLOCK_ALIGN - 1);
+    void* memory = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ++f->stats.maps;
+    close(fd);
+    if (memory == MAP_FAILED)
+        return -1;
+    f->map.data = (unsigned char*) memory;
+    f->map.len = f->size;
+    f->map_len = len;
+    f->mmapped = 1;
+    return 0;
+}
+
+
+// io61_map_sync(f)
+//    Set the size of mapped output file `f` to the end of the data
+//    written (or its original size, if larger), and its file offset to
+//    the current position. Writing past that size grows the file again.
+//    Returns 0 on success and -1 on error.
+
+static int io61_map_sync(io61_file* f) {
+    io61_detach(f);
+    off_t end = f->map_end > (size_t) f->size ? (off_t) f->map_end : f->size;
+    ++f->stats.seeks;
+    if ((f->map.len != (size_t) end && ftruncate(f->fd, end) < 0)
+        || lseek(f->fd, f->pos, SEEK_SET) < 0)
+        return -1;
+    f->map.len = end;
+    f->fdpos = f->pos;
+    return 0;
+}
+
+
+// io61_map_stop(f)
+//    Cut mapped output file `f` back to the data written and unmap it;
+//    `f` continues through the block cache. Returns 0 on success and -1
+//    on error.
+
+static int io61_map_stop(io61_file* f) {
+    if (io61_map_sync(f) < 0)
+        return -1;
+    munmap(f->map.data, f->map_len);
+    ++f->stats.maps;
+    f->map.data = NULL;
+    f->map.len = f->map_len = 0;
+    f->mmapped = 0;
+    return 0;
+}
+
+
+// io61_map_grow(f, need)
+//    Grow mapped output file `f` to at least `need` bytes, doubling so
+//    that growth is rare. The new space is allocated up front: a full
+//    disk would otherwise show up as SIGBUS on a store into the mapping.
+//    If the file or mapping can't grow, the mapping is dropped and `f`
+//    continues through the block cache, which reports such errors as
+//    return values. Returns 0 on success and -1 on error.
+
+static int io61_map_grow(io61_file* f, off_t need) {
+    size_t cap = 2 * f->map.len > MAP_MIN_GROW ? 2 * f->map.len : MAP_MIN_GROW;
+    if (cap < (size_t) need)
+        cap = need;
+    // Never cut off data written behind the mapping's back (io61_copy)
+    if (cap < f->map_end)
+        cap = f->map_end;
+    cap = (cap + BLOCK_ALIGN - 1) & ~(size_t) (BLOCK_ALIGN - 1);
+    if (cap > f->map_len) {
+        void* memory = mremap(f->map.data, f->map_len, cap, MREMAP_MAYMOVE);
+        ++f->stats.maps;
+        if (memory == MAP_FAILED)
+            goto fallback;
+        f->map.data = (unsigned char*) memory;
+        f->map_len = cap;
+    }
+    if (posix_fallocate(f->fd, f->map.len, cap - f->map.len) != 0)
+        goto fallback;
+    f->map.len = cap;
+    return 0;
+
+ fallback:
+    return io61_map_stop(f);
+}
+
+
+// io61_wprepare(f)
+//    Point the write cursor at cache space for the current file position,
+//    writing back cached data if necessary. Returns 0 on success and -1
+//    on error.
+
+static int io61_wprepare(io61_file* f) {
+    off_t pos = io61_tell(f);
+    io61_detach(f);
+    io61_adapt(f);
+
+    // Mapped file: grow it to cover `pos` if necessary
+    if (f->mmapped && pos >= (off_t) f->map.len
+        && io61_map_grow(f, pos + 1) < 0)
+        return -1;
+    if (f->mmapped) {
+        io61_attach(f, &f->map, pos);
+        return 0;
+    }
+
+    io61_block* b;
+    if (!f->seekable) {
+        // Stream: write back the single block, then reuse it
+        b = f->lru_head;
+        if (io61_alloc_block(f, b) < 0 || io61_flush_block(f, b) < 0)
+            return -1;
+        b->off = pos;
+    } else {
+        off_t off = pos - pos % f->block_size;
+        b = io61_find_block(f, off);
+        if (!b && !(b = io61_take_block(f, off)))
+            return -1;
+        // Bytes not contiguous with the extent being written start a new
+        // one; stash the old one, or write the block back if the list of
+        // stashed extents is full
+        size_t o = pos - off;
+        if (b->dirty_first < b->dirty_last
+            && (o < b->dirty_first || o > b->dirty_last)) {
+            if (b->nextents < DIRTY_EXTENTS)
+                io61_stash_extent(b);
+            else if (io61_flush_block(f, b) < 0)
+                return -1;
+        }
+    }
+
+    if (b->dirty_first == b->dirty_last)
+        b->dirty_first = b->dirty_last = pos - b->off;
+    io61_attach(f, b, pos);
+    return 0;
+}
+
+
+// io61_setcache(f, block_size, nblocks)
+//    Set the cache geometry of `f` as for io61_resize_cache, and stop
+//    adapting the block size to the application's requests.
+
+int io61_setcache(io61_file* f, size_t block_size, size_t nblocks) {
+    if (io61_resize_cache(f, block_size, nblocks) < 0)
+        return -1;
+    f->adaptive = 0;
+    return 0;
+}
+
+
+// io61_setmapwindow(f, window)
+//    Map read-only regular file `f` through a sliding window of `window`
+//    bytes (a multiple of 4096), or in full if `window` is 0. The window
+//    moves with the file position. Returns 0 on success and -1 on error,
+//    in which case `f` is read through the block cache.
+
+int io61_setmapwindow(io61_file* f, size_t window) {
+    if (f->mode != O_RDONLY || f->size <= 0 || window % BLOCK_ALIGN != 0
+        || f->direct)
+        return -1;
+    io61_detach(f);
+    if (f->map.data) {
+        munmap(f->map.data, f->map_len);
+        ++f->stats.maps;
+    }
+    f->map.data = NULL;
+    f->map.off = 0;
+    f->map.len = f->map_len = 0;
+    f->map_window = window;
+    f->mmapped = 0;
+    if (window == 0) {
+        void* memory = mmap(NULL, f->size, PROT_READ, MAP_PRIVATE, f->fd, 0);
+        ++f->stats.maps;
+        if (memory == MAP_FAILED)
+            return -1;
+        f->map.data = (unsigned char*) memory;
+        f->map.len = f->map_len = f->size;
+    }
+    // A window is mapped when first read
+    f->mmapped = 1;
+    return 0;
+}
 
-#define CACHE_SIZE 32768
-// INVARIANT: assert(cache->start <= cache->size);
-// CACHE INVALID / EMPTY: cache->size == 0 => cache->start == cache->size
 
-// io61.c
-//    YOUR CODE HERE!
+// io61_setmapoutput(f, enable)
+//    Write write-only regular file `f` through a shared mapping if
+//    `enable` is true, or through the block cache if not. A mapped file
+//    is preallocated ahead of the data written, in steps of at least
+//    MAP_MIN_GROW bytes, and cut back to the data's end only by a flush
+//    or io61_close. A writer that exits without either (a crash, a
+//    signal, or a forgotten close) leaves the file padded with zero
+//    bytes up to the preallocated size. Not available with io_uring,
+//    write-behind or O_DIRECT. Returns 0 on success and -1 on error.
 
-typedef struct io61_cache {
-    unsigned char* memory;
-    size_t size;     // Current size of cache
-    size_t first;    // Position of the first char in writing cache
-    size_t last;     // Position of the last char in writing cache
-    off_t start;     // File offset of first character in cache
-    off_t next;      // File offset of next char to read in cache
-    off_t prev_next; // File offset of previous next
-    off_t end;       // File offset of last valid char in cache
-    int mmapped;     // Flag to 
-} io61_cache;
+int io61_setmapoutput(io61_file* f, int enable) {
+    if (f->mode != O_WRONLY || f->uring || f->writebehind || f->direct)
+        return -1;
+    if (!enable == !f->mmapped)
+        return 0;
+    if (!enable)
+        return io61_map_stop(f);
+    if (io61_flush(f) < 0)
+        return -1;
+    io61_detach(f);
+    f->size = io61_filesize(f);
+    if (io61_map_output(f) < 0)
+        return -1;
+    f->use_uring = 0;
+    return 0;
+}
 
 
-// io61_file
-//    store structure for io61 file wrappers. Add your own stuff.
+// io61_seturing(f, enable)
+//    Turn io_uring I/O on or off for seekable file `f`. Returns 0 on
+//    success and -1 if no io_uring is available, in which case `f` keeps
+//    using synchronous I/O.
 
-struct io61_file {
-    int fd;
-    io61_cache* cache;
-    int mode;
-    off_t size;
-};
+int io61_seturing(io61_file* f, int enable) {
+    if (enable && !f->uring) {
+        if (!f->seekable || f->writebehind || f->direct
+            || io61_uring_start(f) < 0)
+            return -1;
+    } else if (!enable && f->uring) {
+        if (io61_flush(f) < 0)
+            return -1;
+        io61_uring_wait(f, NULL);
+        io61_uring_stop(f);
+    }
+    f->use_uring = enable;
+    return 0;
+}
 
-// min(a, b)
-// Returns the minimum of a and b
-int min(int a , int b) {
-    return (a < b) ? a : b;
+
+// io61_setwritebehind(f, limit)
+//    Turn write-behind mode on for write-only file `f`, with at most
+//    `limit` bytes of buffers waiting to be written, or off if `limit`
+//    is 0. Not available with io_uring or for mapped or paired files.
+//    Returns 0 on success and -1 on error.
+
+int io61_setwritebehind(io61_file* f, size_t limit) {
+    if (f->mode != O_WRONLY || f->uring || f->mmapped || f->direct
+        || (limit && f->pair))
+        return -1;
+    if (limit == 0) {
+        if (io61_flush(f) < 0)
+            return -1;
+        return io61_writebehind_stop(f);
+    }
+    if (!f->writebehind) {
+        io61_writebehind* w = (io61_writebehind*) calloc(1, sizeof(io61_writebehind));
+        if (!w)
+            return -1;
+        w->fd = f->fd;
+        w->seekable = f->seekable;
+        w->size = f->block_size;
+        pthread_mutex_init(&w->mutex, NULL);
+        pthread_cond_init(&w->work, NULL);
+        pthread_cond_init(&w->space, NULL);
+        if (pthread_create(&w->thread, NULL, io61_writebehind_thread, w) != 0) {
+            pthread_mutex_destroy(&w->mutex);
+            pthread_cond_destroy(&w->work);
+            pthread_cond_destroy(&w->space);
+            free(w);
+            return -1;
+        }
+        f->writebehind = w;
+    }
+    pthread_mutex_lock(&f->writebehind->mutex);
+    f->writebehind->limit = limit;
+    pthread_cond_broadcast(&f->writebehind->space);
+    pthread_mutex_unlock(&f->writebehind->mutex);
+    return 0;
+}
+
+
+// io61_setnonblock(f)
+//    Make the descriptor of `f` non-blocking; io61_close restores it.
+//    Returns 0 on success and -1 on error.
+
+static int io61_setnonblock(io61_file* f) {
+    if (f->nonblock)
+        return 0;
+    int flags = fcntl(f->fd, F_GETFL);
+    if (flags < 0 || fcntl(f->fd, F_SETFL, flags | O_NONBLOCK) < 0)
+        return -1;
+    f->nonblock = 2;
+    return 0;
+}
+
+
+// io61_setpair(inf, outf)
+//    Pair input stream `inf` with output `outf`, as for a request/response
+//    protocol over pipes or sockets. Whenever a read of `inf` would
+//    block, the bytes buffered for `outf` are written first, so the peer
+//    gets its request without explicit io61_flush calls, while requests
+//    written back to back still go out together. Both descriptors
+//    become non-blocking, and writes that can't complete wait for space
+//    with poll, reading what arrives on `inf` meanwhile (while its
+//    buffer has room), so peers writing to each other at once don't
+//    deadlock. `inf` is read without a prefetch thread, and `outf` is
+//    written without a write-behind thread. `outf` NULL unpairs `inf`.
+//    Returns 0 on success and -1 on error.
+
+int io61_setpair(io61_file* inf, io61_file* outf) {
+    if (inf->mode != O_RDONLY || inf->seekable || inf->prefetch
+        || (outf && outf->mode != O_WRONLY))
+        return -1;
+    if (inf->pair)
+        inf->pair->pair = NULL;
+    inf->pair = NULL;
+    if (!outf)
+        return 0;
+    if ((outf->writebehind && io61_setwritebehind(outf, 0) < 0)
+        || io61_setnonblock(inf) < 0 || io61_setnonblock(outf) < 0)
+        return -1;
+    if (outf->pair)
+        outf->pair->pair = NULL;
+    inf->pair = outf;
+    outf->pair = inf;
+    inf->prefetch_nbuffers = 0;
+    return 0;
 }
 
-// make_cache()
-//    Returns pointer to instantiated cache 
-io61_cache* make_cache(io61_file* f) {
-    io61_cache* cache = malloc(sizeof(io61_cache));
-    unsigned char* memory = (f->mode == O_RDONLY) ? mmap(NULL, f->size, PROT_READ, MAP_PRIVATE, f->fd, 0) : MAP_FAILED;
-    if (memory != MAP_FAILED) {
-        cache->memory = memory;
-        cache->mmapped = 1;
-        cache->end = f->size;
+
+// io61_direct_start(f, s)
+//    Put regular file `f`, whose status is `*s`, in direct I/O mode,
+//    setting O_DIRECT on its descriptor. Cache blocks are aligned to
+//    BLOCK_ALIGN, which must be a multiple of the file's direct I/O
+//    alignment. Returns 1 on success (2 if O_DIRECT had to be set), and
+//    0 if direct I/O can't be used, in which case O_DIRECT is cleared
+//    and `f` goes through the page cache as usual.
+
+static int io61_direct_start(io61_file* f, const struct stat* s) {
+    int flags = fcntl(f->fd, F_GETFL);
+    if (flags < 0)
+        return 0;
+    size_t align = BLOCK_ALIGN;
+#ifdef STATX_DIOALIGN
+    struct statx sx;
+    if (statx(f->fd, "", AT_EMPTY_PATH, STATX_DIOALIGN, &sx) == 0
+        && (sx.stx_mask & STATX_DIOALIGN)) {
+        align = sx.stx_dio_offset_align;
+        if (sx.stx_dio_mem_align > BLOCK_ALIGN)
+            align = 0;
     }
-    else {
-        cache->memory = calloc(CACHE_SIZE, sizeof(char));
-        cache->mmapped = 0;
+#endif
+    if (!S_ISREG(s->st_mode) || !f->seekable || align == 0
+        || align > BLOCK_ALIGN || BLOCK_ALIGN % align != 0
+        || fcntl(f->fd, F_SETFL, flags | O_DIRECT) < 0) {
+        if (flags & O_DIRECT)
+            (void) fcntl(f->fd, F_SETFL, flags & ~O_DIRECT);
+        return 0;
     }
-    cache->size = cache->first = cache->last = cache->start = cache->next = cache->prev_next = cache->end = 0;
-    return cache;
+    f->dio_align = align;
+    return flags & O_DIRECT ? 1 : 2;
+}
+
+
+// io61_getenv(name, dflt)
+//    Return the value of numeric environment variable `name`, or `dflt`
+//    if it is unset or empty.
+
+static size_t io61_getenv(const char* name, size_t dflt) {
+    const char* s = getenv(name);
+    return s && *s ? strtoul(s, NULL, 0) : dflt;
 }
 
+
 // io61_fdopen(fd, mode)
 //    Return a new io61_file that reads from and/or writes to the given
 //    file descriptor `fd`. `mode` is either O_RDONLY for a read-only file
 //    or O_WRONLY for a write-only file. You need not support read/write
-//    files.
+//    files. With O_DIRECT in `mode` (or on `fd`), data bypasses the page
+//    cache where the file system allows it.
 
 io61_file* io61_fdopen(int fd, int mode) {
     assert(fd >= 0);
-    io61_file* f = (io61_file*) malloc(sizeof(io61_file));
+    io61_file* f = (io61_file*) calloc(1, sizeof(io61_file));
     f->fd = fd;
-    f->mode = mode;
+    f->bfd = -1;
+    f->mode = mode & O_ACCMODE;
     f->size = io61_filesize(f);
-    f->cache = make_cache(f);
+    struct stat s;
+    if (fstat(fd, &s) < 0)
+        memset(&s, 0, sizeof(s));
+    f->ispipe = S_ISFIFO(s.st_mode);
+    f->fdpos = lseek(fd, 0, SEEK_CUR);
+    ++f->stats.seeks;
+    f->seekable = f->fdpos >= 0;
+    f->pos = f->seekable ? f->fdpos : 0;
+    f->pattern_pos = f->pos;
+    f->ra_blocks = 1;
+    int flags = fcntl(fd, F_GETFL);
+    f->nonblock = flags >= 0 && (flags & O_NONBLOCK);
+    if ((mode & O_DIRECT) || (flags >= 0 && (flags & O_DIRECT)))
+        f->direct = io61_direct_start(f, &s);
+    mode = f->mode;
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&f->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+
+    // Map regular files in full, or through a window if that fails or
+    // they are large
+    int map = !f->direct && !io61_getenv("IO61_NOMAP", 0);
+    size_t window = io61_getenv("IO61_MAPWINDOW", 0);
+    off_t full_max = window ? (off_t) window : MAP_FULL_MAX;
+    if (mode == O_RDONLY && f->size > 0 && map) {
+        if (f->size > full_max || io61_setmapwindow(f, 0) < 0)
+            io61_setmapwindow(f, window ? window : MAP_WINDOW);
+    } else if (mode == O_WRONLY && map
+               && io61_getenv("IO61_MAPOUTPUT", IO61_MAPOUTPUT))
+        io61_map_output(f);
+
+    f->use_uring = io61_getenv("IO61_URING", IO61_URING) && f->seekable && !f->mmapped && !f->direct;
+    f->adaptive = 1;
+    f->base_block_size = io61_initial_block_size(f, &s);
+    io61_resize_cache(f, f->base_block_size,
+                      io61_cache_nblocks(f, f->base_block_size));
+    size_t block_size = io61_getenv("IO61_BLOCKSIZE", 0);
+    size_t nblocks = io61_getenv("IO61_NBLOCKS", 0);
+    if (block_size || nblocks) {
+        block_size = block_size ? block_size : f->block_size;
+        io61_setcache(f, block_size, nblocks ? nblocks
+                      : io61_cache_nblocks(f, block_size));
+    }
+    if (mode == O_RDONLY && !f->seekable) {
+        size_t n = io61_getenv("IO61_PREFETCH", PREFETCH_NBUFFERS);
+        f->prefetch_nbuffers = n < PREFETCH_MAX ? n : PREFETCH_MAX;
+    }
+    size_t writebehind = io61_getenv("IO61_WRITEBEHIND", IO61_WRITEBEHIND);
+    if (mode == O_WRONLY && writebehind && !f->direct)
+        io61_setwritebehind(f, writebehind);
     return f;
 }
 
 
+// io61_setprefetch(f, nbuffers)
+//    Set the number of buffers the prefetch thread of stream `f` keeps
+//    filled ahead of the reader; 0 reads synchronously, as paired
+//    inputs do. Must be called before the first read. Returns 0 on
+//    success and -1 on error.
+
+int io61_setprefetch(io61_file* f, unsigned nbuffers) {
+    if (f->mode != O_RDONLY || f->seekable || f->prefetch
+        || nbuffers > PREFETCH_MAX || (nbuffers && f->pair))
+        return -1;
+    f->prefetch_nbuffers = nbuffers;
+    return 0;
+}
+
+
+// io61_stats(f, out)
+//    Store the I/O counters of `f` in `*out`. Returns 0.
+
+int io61_stats(io61_file* f, io61_counters* out) {
+    if (f->locking)
+        io61_lock(f);
+    *out = f->stats;
+    if (f->locking)
+        io61_unlock(f);
+    return 0;
+}
+
+
+// io61_stats_collect(f)
+// io61_stats_total(out)
+//    io61_close adds the counters of each file to a process-wide total,
+//    which io61_stats_total stores in `*out`. io61_profile_end reports it.
+
+static io61_counters io61_total;
+static pthread_mutex_t io61_total_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void io61_stats_collect(io61_file* f) {
+    pthread_mutex_lock(&io61_total_lock);
+    io61_total.reads += f->stats.reads;
+    io61_total.writes += f->stats.writes;
+    io61_total.seeks += f->stats.seeks;
+    io61_total.maps += f->stats.maps;
+    io61_total.copies += f->stats.copies;
+    io61_total.bytes_read += f->stats.bytes_read;
+    io61_total.bytes_written += f->stats.bytes_written;
+    io61_total.hits += f->stats.hits;
+    io61_total.misses += f->stats.misses;
+    io61_total.seek_misses += f->stats.seek_misses;
+    io61_total.flushes += f->stats.flushes;
+    io61_total.flush_bytes += f->stats.flush_bytes;
+    pthread_mutex_unlock(&io61_total_lock);
+}
+
+void io61_stats_total(io61_counters* out) {
+    pthread_mutex_lock(&io61_total_lock);
+    *out = io61_total;
+    pthread_mutex_unlock(&io61_total_lock);
+}
+
+
 // io61_close(f)
 //    Close the io61_file `f` and release all its resources, including
 //    any buffers.
 
 int io61_close(io61_file* f) {
-    io61_flush(f);
-    int r = close(f->fd);
+    int r = io61_flush(f);
+    if (f->mode == O_RDONLY)
+        (void) io61_seek_fd(f, io61_tell(f));
+    io61_prefetch_stop(f);
+    io61_writebehind_stop(f);
+    if (f->uring) {
+        io61_uring_wait(f, NULL);
+        io61_uring_stop(f);
+    }
+    // Others sharing the descriptor don't expect the flags io61 set
+    int clear = (f->direct == 2 ? O_DIRECT : 0)
+        | (f->nonblock == 2 ? O_NONBLOCK : 0);
+    if (clear) {
+        int flags = fcntl(f->fd, F_GETFL);
+        if (flags >= 0)
+            (void) fcntl(f->fd, F_SETFL, flags & ~clear);
+    }
+    if (f->pair)
+        f->pair->pair = NULL;
+    if (close(f->fd) < 0)
+        r = -1;
+    if (f->bfd >= 0)
+        close(f->bfd);
     // free the cache
-    if (f->cache->mmapped)
-        munmap(f->cache->memory, f->size);
-    else
-        free(f->cache->memory);
-    free(f->cache);
+    if (f->map.data) {
+        munmap(f->map.data, f->map_len);
+        ++f->stats.maps;
+    }
+    io61_stats_collect(f);
+    for (size_t i = 0; i < f->nblocks; ++i)
+        free(f->blocks[i].data);
+    free(f->blocks);
+    free(f->buckets);
+    free(f->flush_order);
+    free(f->line);
+    pthread_mutex_destroy(&f->lock);
     free(f);
     return r;
 }
 
 
-// io61_readc(f)
-//    Read a single (unsigned) character from `f` and return it. Returns EOF
-//    (which is -1) on error or end-of-file.
+// io61_readc_fill(f)
+//    Read a single (unsigned) character from `f` and return it, refilling
+//    the cursor if it is empty. Returns EOF (which is -1) on error or
+//    end-of-file. The inline io61_readc only calls out when the cursor
+//    is empty (or `f` is locked).
 
-int io61_readc(io61_file* f) {
-    // If f was opened read-only...
+static int io61_readc_fill(io61_file* f) {
+    if (f->cur < f->rlim)
+        return *f->cur++;
     if (f->mode != O_RDONLY)
-        return -1;
-
-    // Alias for file cache
-    io61_cache* cache = f->cache;
-    // If file is memory mapped...
-    if (cache->mmapped) {
-        // Update the cache position
-        cache->next++;
-
-        // If cache is still valid return char, else return EOF
-        return (cache->next > f->size) ? EOF : *(cache->memory + cache->next - 1);
-
-    }
-    // Else if the cache is valid...
-    else if (cache->next < cache->end) {
-        // Update the cache position
-        cache->next++;
-        // Return the next char from cache
-        return *(cache->memory + cache->next - cache->start - 1);
-    }
-    // The cache is invalid/empty
-    else {
-        // Mark the cache as valid
-        cache->start = cache->end;
-
-        // Read directly from the file
-        ssize_t size = read(f->fd, cache->memory, CACHE_SIZE);
-        
-        // If able to read more than 0...
-        if (size > 0) {
-            // ...update the cache end offset
-            cache->end += size;
-            // Update the cache position
-            cache->next++;
-            // Read the next char from cache
-            return *(cache->memory + cache->next - cache->start - 1);
-        }
-        else
-            return EOF;
-    }
+        return EOF;
+    ++f->req_count;
+    ++f->req_bytes;
+    if (io61_fill(f) <= 0)
+        return EOF;
+    return *f->cur++;
 }
 
 
-// io61_read(f, buf, sz)
+// io61_read_unlocked(f, buf, sz)
 //    Read up to `sz` characters from `f` into `buf`. Returns the number of
 //    characters read on success; normally this is `sz`. Returns a short
 //    count if the file ended before `sz` characters could be read. Returns
 //    -1 an error occurred before any characters were read.
 
-ssize_t io61_read(io61_file* f, char* buf, size_t sz) {
+static ssize_t io61_read_unlocked(io61_file* f, char* buf, size_t sz) {
     // If f was not opened read-only...
     if (f->mode != O_RDONLY)
         return -1;
-
-    // Alias for f->cache
-    io61_cache* cache = f->cache;
-
-    // If file is memory mapped...
-    if (cache->mmapped) {
-        // Determine the size to read from the memory map
-        ssize_t size = min(f->size - cache->next, sz);
-
-
-        // Copy from memory map into the buffer
-        memcpy(buf, cache->memory + cache->next, size);
-
-        // Update the cache position
-        cache->next += size;
-
-        // Return the amount that was read
-        return size;
-    }
+    ++f->req_count;
+    f->req_bytes += sz;
 
     size_t nread = 0; // number of characters read so far
-
     while (nread != sz) {
-        // If the cache is valid...
-        if (cache->next < cache->end) {
-            // Determine the size to read from the cache
-            ssize_t size = min(cache->end - cache->next, sz - nread);
-            
-            // Copy from cache into the buffer
-            memcpy(buf + nread, cache->memory +  cache->next - cache->start, size);
-
-            // Update the cache position
-            cache->next += size;
-
-            // Update the amount read from the cache
-            nread += size;
+        // Copy what the cursor has available
+        if (f->cur < f->rlim) {
+            size_t n = min(f->rlim - f->cur, sz - nread);
+            memcpy(buf + nread, f->cur, n);
+            f->cur += n;
+            nread += n;
         }
-        // Else, the cache is invalid/empty...
+        // Else refill from the cache or the file
         else {
-            // Mark the cache as valid
-            cache->start = cache->end;
-            // Read directly from file
-            ssize_t size = read(f->fd, cache->memory, CACHE_SIZE);
-            // If able to read more than 0...
-            if (size > 0)
-                cache->end += size; // ...update the cache end offset
-            else
-                return (ssize_t) nread ? (ssize_t) nread : size;
+            int r = io61_fill(f);
+            if (r <= 0)
+                return nread ? (ssize_t) nread : r;
         }
     }
     return nread;
 }
 
 
-// io61_writec(f)
-//    Write a single character `ch` to `f`. Returns 0 on success or
-//    -1 on error.
+// io61_readline_unlocked(f, line)
+//    Read the next line of `f`, including its newline, and set `*line`
+//    to point at it. Returns the line's length, 0 at end-of-file, or -1
+//    on error; the last line of a file may lack a newline. A line that
+//    lies within the cursor's bytes is returned in place, without
+//    copying; only a line that spans a refill is copied, into `f->line`.
+//    Either way, `*line` is valid until the next call on `f`.
 
-int io61_writec(io61_file* f, int ch) {
-    // If f was not opened write-only...
-    if (f->mode != O_WRONLY)
+static ssize_t io61_readline_unlocked(io61_file* f, const char** line) {
+    if (f->mode != O_RDONLY)
         return -1;
+    ++f->req_count;
 
-    // Alias the file cache
-    io61_cache* cache = f->cache;
+    size_t len = 0; // number of characters copied into f->line
+    while (1) {
+        if (f->cur < f->rlim) {
+            size_t avail = f->rlim - f->cur;
+            unsigned char* nl = (unsigned char*) memchr(f->cur, '\n', avail);
+            size_t n = nl ? (size_t) (nl + 1 - f->cur) : avail;
+            // Common case: the whole line is in the cursor
+            if (nl && len == 0) {
+                *line = (const char*) f->cur;
+                f->cur += n;
+                f->req_bytes += n;
+                return n;
+            }
+            if (len + n > f->line_cap) {
+                size_t cap = f->line_cap ? f->line_cap : 128;
+                while (cap < len + n)
+                    cap *= 2;
+                char* p = (char*) realloc(f->line, cap);
+                if (!p)
+                    return len ? (ssize_t) len : -1;
+                f->line = p;
+                f->line_cap = cap;
+            }
+            memcpy(f->line + len, f->cur, n);
+            f->cur += n;
+            len += n;
+            if (nl)
+                break;
+        } else {
+            int r = io61_fill(f);
+            if (r < 0 && len == 0)
+                return -1;
+            else if (r <= 0)
+                break;
+        }
+    }
+    f->req_bytes += len;
+    *line = f->line;
+    return len;
+}
 
-    const char* buf = (const char*) &ch;
 
-    // Determine how much space is left in cache
-    size_t available = CACHE_SIZE - cache->size;
+// io61_writec_flush(f, ch)
+//    Write a single character `ch` to `f`, making room in the cache if
+//    the cursor is full. Returns 0 on success or -1 on error.
 
-    // If cache is already full...
-    if (!available) {
-        //...write the cache to the file.
-        ssize_t cleared = write(f->fd, cache->memory + cache->first, CACHE_SIZE - cache->first);
-        // If able to write some of cache to file...
-        if (cleared >= 0) {
-            cache->first += cleared;
-            cache->size -= cleared;
-            // Check to see if last or first at the end of cache
-            cache->first = (CACHE_SIZE == cache->first) ? 0 : cache->first;
-            cache->last = (CACHE_SIZE == cache->last) ? 0 : cache->last;
-        }
-        // Else write not successful
-        else
-            return -1;   
-    }
-    // Write char to cache...
-    *(cache->memory + cache->last) = *buf;
-    // Update position of last char in cache
-    cache->last++;
-    // Update cache size
-    cache->size++;
+static int io61_writec_flush(io61_file* f, int ch) {
+    if (f->cur < f->wlim) {
+        *f->cur++ = ch;
+        return 0;
+    }
+    if (f->mode != O_WRONLY)
+        return -1;
+    ++f->req_count;
+    ++f->req_bytes;
+    if (io61_wprepare(f) < 0)
+        return -1;
+    *f->cur++ = ch;
     return 0;
 }
 
 
-// io61_write(f, buf, sz)
+// io61_write_unlocked(f, buf, sz)
 //    Write `sz` characters from `buf` to `f`. Returns the number of
 //    characters written on success; normally this is `sz`. Returns -1 if
 //    an error occurred before any characters were written.
 
-ssize_t io61_write(io61_file* f, const char* buf, size_t sz) {
+static ssize_t io61_write_unlocked(io61_file* f, const char* buf, size_t sz) {
     // If f was not opened for write-only...
     if (f->mode != O_WRONLY)
         return -1;
+    ++f->req_count;
+    f->req_bytes += sz;
 
-    // Create an alias for the file cache
-    io61_cache* cache = f->cache;
-   
     size_t nwritten = 0;
-
     while (nwritten != sz) {
+        // Copy into the space the cursor has available
+        if (f->cur < f->wlim) {
+            size_t n = min(f->wlim - f->cur, sz - nwritten);
+            memcpy(f->cur, buf + nwritten, n);
+            f->cur += n;
+            nwritten += n;
+        }
+        // Else make room in the cache
+        else if (io61_wprepare(f) < 0)
+            return nwritten ? (ssize_t) nwritten : -1;
+    }
+    return nwritten;
+}
 
-        // Determine how much space is left in cache 
-        size_t available = CACHE_SIZE - cache->size;
 
-        // If the previous next is not the same as the current next...
-        if (cache->prev_next != cache->next) {
-            //...seek back to previous next
-            off_t r = lseek(f->fd, cache->prev_next, SEEK_SET);
-            if (r != cache->prev_next)
-                return -1;
-            //...write the cache to file
-            ssize_t cleared = write(f->fd, cache->memory + cache->first, cache->size);
-            
-            if (cleared >= 0) {
-                // update the previous next to next, if all of the cache was read 
-                cache->prev_next = ((size_t) cleared != cache->size) ? (cache->prev_next + cleared) : cache->next;
-                // ...update cache first, end, and size
-                cache->first += cleared;
-                cache->size -= cleared;
-                // Check to see if last or first at the end of cache
-                cache->first = (CACHE_SIZE == cache->first) ? 0 : cache->first;
-                cache->last = (CACHE_SIZE == cache->last) ? 0 : cache->last;
-                // ...see back to next
-                lseek(f->fd, cache->next, SEEK_SET);
-                off_t r = lseek(f->fd, cache->prev_next, SEEK_SET);
-                if (r != cache->prev_next)
-                    return (ssize_t) nwritten ? (ssize_t) nwritten : cleared;
-            }
-            // Else write not successful
-            else
-                return (ssize_t) nwritten ? (ssize_t) nwritten : cleared; 
-        }
-        // If cache already full...
-        else if (!available) {
-            //...write the cache to the file.
-            ssize_t cleared = write(f->fd, cache->memory + cache->first, CACHE_SIZE - cache->first);
-            // If able to write some of cache to file...
-            if (cleared >= 0) {
-                // ...update cache first, end, and size
-                cache->first += cleared;
-                cache->size -= cleared;
-                // Check to see if last or first at the end of cache
-                cache->first = (CACHE_SIZE == cache->first) ? 0 : cache->first;
-                cache->last = (CACHE_SIZE == cache->last) ? 0 : cache->last;
-            }
-            // Else write not successful
-            else
-                return (ssize_t) nwritten ? (ssize_t) nwritten : cleared;             
+// io61_iov_slice(v, iov, iovcnt, i, skip)
+//    Copy up to IOV_BATCH iovecs starting `skip` bytes into `iov[i]` to
+//    `v`. Returns the number copied and the bytes they cover in `*sz`.
+
+static int io61_iov_slice(struct iovec* v, const struct iovec* iov, int iovcnt,
+                          int i, size_t skip, size_t* sz) {
+    int n = 0;
+    *sz = 0;
+    for (; i < iovcnt && n < IOV_BATCH; ++i, ++n, skip = 0) {
+        v[n].iov_base = (char*) iov[i].iov_base + skip;
+        v[n].iov_len = iov[i].iov_len - skip;
+        *sz += v[n].iov_len;
+    }
+    return n;
+}
+
+
+// io61_iov_advance(iov, iovcnt, i, skip, k)
+//    Move the position (`*i`, `*skip`) in `iov` forward by `k` bytes.
+
+static void io61_iov_advance(const struct iovec* iov, int iovcnt,
+                             int* i, size_t* skip, size_t k) {
+    while (*i < iovcnt && k >= iov[*i].iov_len - *skip) {
+        k -= iov[*i].iov_len - *skip;
+        ++*i;
+        *skip = 0;
+    }
+    *skip += k;
+}
+
+
+// io61_readv_unlocked(f, iov, iovcnt)
+//    Read into the `iovcnt` buffers described by `iov`, in order, like
+//    io61_read. Once buffered data runs out, requests of at least a
+//    block go straight from the file into the buffers with one readv
+//    (except with direct I/O, which needs aligned buffers).
+
+static ssize_t io61_readv_unlocked(io61_file* f, const struct iovec* iov, int iovcnt) {
+    if (f->mode != O_RDONLY)
+        return -1;
+    size_t nread = 0, skip = 0;
+    int i = 0;
+    while (i < iovcnt) {
+        struct iovec v[IOV_BATCH];
+        size_t sz;
+        int n = io61_iov_slice(v, iov, iovcnt, i, skip, &sz);
+        ssize_t r;
+        if (f->cur == f->rlim && !f->mmapped && !f->prefetch && !f->direct
+            && sz >= f->block_size) {
+            off_t pos = io61_tell(f);
+            io61_detach(f);
+            r = io61_readv_at(f, v, n, pos);
+            if (r < 0 && (errno == EINTR
+                          || (errno == EAGAIN && io61_wait(f, POLLIN) == 0)))
+                continue;
+            if (r > 0)
+                f->pos = pos + r;
+            // A stream may return less than asked before end of file
+            if (!f->seekable)
+                sz = r;
+        } else {
+            r = io61_read_unlocked(f, (char*) v[0].iov_base, v[0].iov_len);
+            sz = v[0].iov_len;
         }
-        // Else, there is space in the cache...
-        else {
-            //...determine how much to write into the cache
-            ssize_t size = min(sz - nwritten, available); 
-            //...write into the cache
-            memcpy(cache->memory + cache->last, buf + nwritten, size);
-            // ... update the cache last
-            cache->last += size;
-            // ...update the cache size
-            cache->size += size;
-            //...and update how much as been written
-            nwritten += size;
+        if (r <= 0)
+            return nread ? (ssize_t) nread : r;
+        nread += r;
+        io61_iov_advance(iov, iovcnt, &i, &skip, r);
+        if ((size_t) r < sz)
+            break;
+    }
+    return nread;
+}
+
+
+// io61_writev_unlocked(f, iov, iovcnt)
+//    Write the `iovcnt` buffers described by `iov`, in order, like
+//    io61_write. On a stream, requests of at least a block go out with
+//    one writev, together with any bytes already buffered.
+
+static ssize_t io61_writev_unlocked(io61_file* f, const struct iovec* iov, int iovcnt) {
+    if (f->mode != O_WRONLY)
+        return -1;
+    size_t nwritten = 0, skip = 0;
+    int i = 0;
+    while (i < iovcnt) {
+        struct iovec v[IOV_BATCH];
+        size_t sz;
+        int n = io61_iov_slice(v + 1, iov, iovcnt, i, skip, &sz);
+        if (f->seekable || f->writebehind || n == IOV_BATCH
+            || sz < f->block_size) {
+            ssize_t w = io61_write_unlocked(f, (const char*) v[1].iov_base, v[1].iov_len);
+            if (w < 0)
+                return nwritten ? (ssize_t) nwritten : -1;
+            nwritten += w;
+            io61_iov_advance(iov, iovcnt, &i, &skip, w);
+            if ((size_t) w != v[1].iov_len)
+                break;
+            continue;
+        }
+
+        // Stream: buffered bytes first, then the request
+        io61_detach(f);
+        io61_block* b = f->lru_head;
+        // A stream's buffered bytes form at most one extent
+        io61_stash_extent(b);
+        io61_extent* x = &b->extents[0];
+        size_t buffered = b->nextents ? x->last - x->first : 0;
+        v[0].iov_base = b->data + x->first;
+        v[0].iov_len = buffered;
+        ssize_t w = io61_writev_at(f, v, n + 1, 0);
+        if (w < 0 && (errno == EINTR
+                      || (errno == EAGAIN && io61_wait(f, POLLOUT) == 0)))
+            continue;
+        if (w <= 0)
+            return nwritten ? (ssize_t) nwritten : -1;
+        if ((size_t) w < buffered) {
+            x->first += w;
+            continue;
         }
+        b->nextents = 0;
+        w -= buffered;
+        f->pos += w;
+        nwritten += w;
+        io61_iov_advance(iov, iovcnt, &i, &skip, w);
     }
     return nwritten;
 }
 
 
-// io61_flush(f)
+// io61_pread_unlocked(f, buf, sz, off)
+// io61_pwrite_unlocked(f, buf, sz, off)
+//    Read or write up to `sz` characters at file offset `off`, like
+//    io61_read and io61_write, without changing the file position. The
+//    bytes go through the cache. Returns -1 if `f` can't seek.
+
+static ssize_t io61_pread_unlocked(io61_file* f, char* buf, size_t sz, off_t off) {
+    if (!f->seekable || off < 0 || f->mode != O_RDONLY) {
+        errno = f->seekable ? EINVAL : ESPIPE;
+        return -1;
+    }
+    off_t pos = io61_tell(f);
+    io61_detach(f);
+    f->pos = off;
+    ssize_t n = io61_read_unlocked(f, buf, sz);
+    io61_detach(f);
+    f->pos = pos;
+    return n;
+}
+
+static ssize_t io61_pwrite_unlocked(io61_file* f, const char* buf, size_t sz, off_t off) {
+    if (!f->seekable || off < 0 || f->mode != O_WRONLY) {
+        errno = f->seekable ? EINVAL : ESPIPE;
+        return -1;
+    }
+    off_t pos = io61_tell(f);
+    io61_detach(f);
+    f->pos = off;
+    ssize_t n = io61_write_unlocked(f, buf, sz);
+    io61_detach(f);
+    f->pos = pos;
+    return n;
+}
+
+
+// io61_flush_unlocked(f)
 //    Forces a write of all buffered data written to `f`.
 //    If `f` was opened read-only, io61_flush(f) may either drop all
 //    data buffered for reading, or do nothing.
 
-int io61_flush(io61_file* f) {
+static int io61_flush_unlocked(io61_file* f) {
     // If f was opened read-only...
     if (f->mode == O_RDONLY)
         return 0;
-    // Alias for file cache
-    io61_cache* cache = f->cache;
-    // While the cache is not empty...
-    while (cache->size) {
-        size_t size = cache->first ? CACHE_SIZE - cache->first : cache->last;
-        //...write the cache to the file.
-        ssize_t cleared = write(f->fd, cache->memory + cache->first, size);
-        // If able to write some of cache to file...
-        if (cleared > 0) {
-            // ...update cache position and size
-            cache->first += cleared;
-            cache->size -= cleared;
-        }
-        // Else if nothing was written...
-        else if (cleared == 0) {
-            cache->first = cleared;
-        }
-        // Else not able to write successfully       
-        else
-            return -1;
+
+    // Mapped file: the data is already in the page cache
+    if (f->mmapped)
+        return io61_map_sync(f);
+
+    io61_detach(f);
+    if (f->uring)
+        io61_uring_writeback(f, f->nblocks);
+    int r = 0;
+    if (!f->seekable || f->writebehind) {
+        // Write back (or queue) dirty blocks, least recently used first
+        for (io61_block* b = f->lru_tail; b; b = b->lru_prev)
+            if (io61_flush_block(f, b) < 0)
+                r = -1;
+    } else {
+        r = io61_flush_sorted(f);
     }
-    return 0;
+    // In write-behind mode, wait for the writes and report any error
+    if (f->writebehind && io61_writebehind_wait(f) < 0)
+        r = -1;
+    // Leave the kernel file offset at the file position, as a program
+    // sharing the descriptor would expect
+    if (io61_seek_fd(f, f->pos) < 0)
+        r = -1;
+    return r;
 }
 
 
-// io61_seek(f, pos)
+// io61_seek_unlocked(f, pos)
 //    Change the file pointer for file `f` to `pos` bytes into the file.
 //    Returns 0 on success and -1 on failure.
 
-int io61_seek(io61_file* f, off_t pos) {
-    // Alias the cache
-    io61_cache* cache = f->cache;
-    if (pos < cache->start || pos > cache->end) {
-        off_t aligned_off = pos - (pos % CACHE_SIZE);
-        off_t r = lseek(f->fd, aligned_off, SEEK_SET);
-        if (r != aligned_off)
-            return -1;
-        cache->start = cache->end = aligned_off;
+static int io61_seek_unlocked(io61_file* f, off_t pos) {
+    if (!f->seekable || pos < 0)
+        return -1;
+    io61_observe(f, pos);
+
+    // Move within the current block if possible
+    io61_block* b = f->blk;
+    if (b && pos >= b->off) {
+        size_t o = pos - b->off;
+        if (f->mode == O_RDONLY && o <= b->len) {
+            f->cur = b->data + o;
+            return 0;
+        }
+        if (f->mode == O_WRONLY && b == &f->map && o <= b->len) {
+            // Record the bytes written so far, then place the cursor
+            io61_detach(f);
+            io61_attach(f, b, pos);
+            return 0;
+        }
+        if (f->mode == O_WRONLY && b != &f->map) {
+            // Keep the dirty extent contiguous
+            size_t cur = f->cur - b->data;
+            if (cur > b->dirty_last)
+                b->dirty_last = cur;
+            if (o >= b->dirty_first && o <= b->dirty_last) {
+                f->cur = b->data + o;
+                return 0;
+            }
+        }
+    }
+
+    io61_detach(f);
+    f->pos = pos;
+    // Count seeks away from everything cached: the next access misses
+    off_t off = pos - pos % f->block_size;
+    if (!(f->map.data && pos >= f->map.off
+          && pos < f->map.off + (off_t) f->map.len)
+        && !io61_find_block(f, off))
+        ++f->stats.seek_misses;
+    return 0;
+}
+
+
+// io61_copy_kernel(inf, outf, sz, method)
+//    Copy up to `sz` bytes from `inf` to `outf` at their current
+//    positions without passing through user space, using kernel copy
+//    method `*method` or a later one:
+//    0: copy_file_range, for two regular files;
+//    1: sendfile, from a regular file;
+//    2: splice, to or from a pipe;
+//    3: splice through a temporary pipe.
+//    Advances `*method` past methods the files don't support. Returns
+//    the number of bytes copied, 0 at end of file, or -1 on error (with
+//    `*method` 4 if nothing applies).
+
+static ssize_t io61_copy_kernel(io61_file* inf, io61_file* outf, size_t sz,
+                                int* method) {
+    loff_t inoff = inf->pos, outoff = outf->pos;
+    loff_t* inoffp = inf->seekable ? &inoff : NULL;
+    loff_t* outoffp = outf->seekable ? &outoff : NULL;
+    ssize_t n = -1;
+    if (sz > (1U << 30))
+        sz = 1U << 30;
+
+    for (; *method < 4; ++*method) {
+        if (*method == 0 && inf->size >= 0 && outf->size >= 0)
+            n = copy_file_range(inf->fd, &inoff, outf->fd, &outoff, sz, 0);
+        else if (*method == 1 && inf->size >= 0) {
+            // sendfile writes at the output's file offset
+            if (io61_seek_fd(outf, outf->pos) < 0)
+                return -1;
+            n = sendfile(outf->fd, inf->fd, &inoff, sz);
+            if (n > 0 && outf->seekable)
+                outf->fdpos += n;
+        } else if (*method == 2 && (inf->ispipe || outf->ispipe))
+            n = splice(inf->fd, inf->ispipe ? NULL : inoffp,
+                       outf->fd, outf->ispipe ? NULL : outoffp,
+                       sz, SPLICE_F_MOVE);
+        else if (*method == 3) {
+            int p[2];
+            if (pipe(p) < 0)
+                return -1;
+            n = splice(inf->fd, inoffp, p[1], NULL, sz, SPLICE_F_MOVE);
+            // Once in the pipe, bytes must reach the output
+            for (ssize_t left = n; left > 0; ) {
+                ssize_t w = splice(p[0], NULL, outf->fd, outoffp, left, SPLICE_F_MOVE);
+                if (w <= 0) {
+                    n = -1;
+                    break;
+                }
+                left -= w;
+            }
+            close(p[0]);
+            close(p[1]);
+        } else
+            continue;
+
+        ++outf->stats.copies;
+        if (n > 0) {
+            inf->stats.bytes_read += n;
+            outf->stats.bytes_written += n;
+        }
+        if (n >= 0 || (errno != EINVAL && errno != ENOSYS && errno != EXDEV
+                       && errno != EOPNOTSUPP && errno != EBADF))
+            return n;
+    }
+    return -1;
+}
+
+
+// io61_copy_unlocked(inf, outf, sz)
+//    Copy up to `sz` bytes from `inf` to `outf`, starting at their
+//    current positions. Returns the number of bytes copied, which is
+//    short only at end of file or on error, or -1 if an error occurred
+//    before any bytes were copied. Bytes already buffered in `inf` are
+//    copied first, and `outf` is flushed; the rest moves inside the
+//    kernel where the file types allow, and through the caches
+//    otherwise.
+
+static ssize_t io61_copy_unlocked(io61_file* inf, io61_file* outf, size_t sz) {
+    if (inf->mode != O_RDONLY || outf->mode != O_WRONLY)
+        return -1;
+    size_t ncopied = 0;
+    int method = 0;
+
+    // Kernel copies can't wait for non-blocking descriptors
+    if (inf->nonblock || outf->nonblock)
+        method = 4;
+    // A prefetch thread has read ahead of the kernel: halt it, and copy
+    // the buffers it filled before handing the pipe to the kernel
+    if (inf->prefetch && method < 4)
+        io61_prefetch_halt(inf);
+
+    while (ncopied < sz) {
+        // Once no bytes are buffered (or the input is mapped), try the
+        // kernel; the output must be flushed first
+        if (method < 4 && !inf->prefetch
+            && (inf->mmapped || inf->cur == inf->rlim)) {
+            if (io61_flush_unlocked(outf) < 0) {
+                method = 4;
+                continue;
+            }
+            io61_detach(inf);
+            io61_detach(outf);
+            ssize_t n = io61_copy_kernel(inf, outf, sz - ncopied, &method);
+            if (n <= 0 && method < 4)
+                return ncopied || n == 0 ? (ssize_t) ncopied : -1;
+            if (n > 0) {
+                inf->pos += n;
+                outf->pos += n;
+                ncopied += n;
+                if (outf->mmapped && (size_t) outf->pos > outf->map_end)
+                    outf->map_end = outf->pos;
+            }
+            continue;
+        }
+
+        // Otherwise copy from cache to cache
+        if (inf->cur == inf->rlim) {
+            int r = io61_fill(inf);
+            if (r <= 0)
+                return ncopied || r == 0 ? (ssize_t) ncopied : -1;
+            continue;
+        }
+        size_t n = min(inf->rlim - inf->cur, sz - ncopied);
+        ssize_t w = io61_write_unlocked(outf, (const char*) inf->cur, n);
+        if (w < 0)
+            return ncopied ? (ssize_t) ncopied : -1;
+        inf->cur += w;
+        ncopied += w;
+        if ((size_t) w != n)
+            break;
     }
-    cache->prev_next = cache->next;
-    cache->next = pos;
+    return ncopied;
+}
+
+
+// io61_setlocking(f, enable)
+//    Turn locked mode on or off for `f`. In locked mode, each call on
+//    `f` holds its lock, so several threads can use `f` at once. Turn it
+//    on before sharing `f`. Returns 0.
+
+int io61_setlocking(io61_file* f, int enable) {
+    f->locking = enable != 0;
     return 0;
 }
 
 
+// io61_lock(f)
+// io61_unlock(f)
+//    Acquire or release the lock of `f`, like flockfile and funlockfile.
+//    The lock is recursive, so a thread holding it can still call the
+//    locking functions; the `_unlocked` functions need it held (or `f`
+//    unshared).
+
+void io61_lock(io61_file* f) {
+    pthread_mutex_lock(&f->lock);
+}
+
+void io61_unlock(io61_file* f) {
+    pthread_mutex_unlock(&f->lock);
+}
+
+
+// io61_readc_slow(f), io61_writec_slow(f, ch), io61_read(f, buf, sz),
+// io61_write(f, buf, sz), io61_readv(f, iov, iovcnt),
+// io61_writev(f, iov, iovcnt), io61_pread(f, buf, sz, off),
+// io61_pwrite(f, buf, sz, off), io61_flush(f), io61_seek(f, pos)
+//    Call the `_unlocked` version, holding the lock of `f` in locked
+//    mode. io61_readc_slow and io61_writec_slow are the out-of-line
+//    halves of the inline io61_readc and io61_writec in io61.h.
+
+int io61_readc_slow(io61_file* f) {
+    if (!f->locking)
+        return io61_readc_fill(f);
+    io61_lock(f);
+    int ch = io61_readc_fill(f);
+    io61_unlock(f);
+    return ch;
+}
+
+int io61_writec_slow(io61_file* f, int ch) {
+    if (!f->locking)
+        return io61_writec_flush(f, ch);
+    io61_lock(f);
+    int r = io61_writec_flush(f, ch);
+    io61_unlock(f);
+    return r;
+}
+
+ssize_t io61_read(io61_file* f, char* buf, size_t sz) {
+    if (!f->locking)
+        return io61_read_unlocked(f, buf, sz);
+    io61_lock(f);
+    ssize_t n = io61_read_unlocked(f, buf, sz);
+    io61_unlock(f);
+    return n;
+}
+
+ssize_t io61_write(io61_file* f, const char* buf, size_t sz) {
+    if (!f->locking)
+        return io61_write_unlocked(f, buf, sz);
+    io61_lock(f);
+    ssize_t n = io61_write_unlocked(f, buf, sz);
+    io61_unlock(f);
+    return n;
+}
+
+ssize_t io61_readv(io61_file* f, const struct iovec* iov, int iovcnt) {
+    if (!f->locking)
+        return io61_readv_unlocked(f, iov, iovcnt);
+    io61_lock(f);
+    ssize_t n = io61_readv_unlocked(f, iov, iovcnt);
+    io61_unlock(f);
+    return n;
+}
+
+ssize_t io61_writev(io61_file* f, const struct iovec* iov, int iovcnt) {
+    if (!f->locking)
+        return io61_writev_unlocked(f, iov, iovcnt);
+    io61_lock(f);
+    ssize_t n = io61_writev_unlocked(f, iov, iovcnt);
+    io61_unlock(f);
+    return n;
+}
+
+ssize_t io61_pread(io61_file* f, char* buf, size_t sz, off_t off) {
+    if (!f->locking)
+        return io61_pread_unlocked(f, buf, sz, off);
+    io61_lock(f);
+    ssize_t n = io61_pread_unlocked(f, buf, sz, off);
+    io61_unlock(f);
+    return n;
+}
+
+ssize_t io61_pwrite(io61_file* f, const char* buf, size_t sz, off_t off) {
+    if (!f->locking)
+        return io61_pwrite_unlocked(f, buf, sz, off);
+    io61_lock(f);
+    ssize_t n = io61_pwrite_unlocked(f, buf, sz, off);
+    io61_unlock(f);
+    return n;
+}
+
+int io61_flush(io61_file* f) {
+    if (!f->locking)
+        return io61_flush_unlocked(f);
+    io61_lock(f);
+    int r = io61_flush_unlocked(f);
+    io61_unlock(f);
+    return r;
+}
+
+int io61_seek(io61_file* f, off_t pos) {
+    if (!f->locking)
+        return io61_seek_unlocked(f, pos);
+    io61_lock(f);
+    int r = io61_seek_unlocked(f, pos);
+    io61_unlock(f);
+    return r;
+}
+
+
+// io61_readline(f, line)
+// io61_getline(f, bufp, capp)
+//    Read the next line of `f`. io61_readline works like
+//    io61_readline_unlocked. io61_getline copies the line into `*bufp`,
+//    growing it with realloc as needed (like POSIX getline), and
+//    null-terminates it. Both return the line's length, 0 at
+//    end-of-file, or -1 on error.
+
+ssize_t io61_readline(io61_file* f, const char** line) {
+    if (!f->locking)
+        return io61_readline_unlocked(f, line);
+    io61_lock(f);
+    ssize_t n = io61_readline_unlocked(f, line);
+    io61_unlock(f);
+    return n;
+}
+
+ssize_t io61_getline(io61_file* f, char** bufp, size_t* capp) {
+    if (f->locking)
+        io61_lock(f);
+    const char* line = "";
+    ssize_t n = io61_readline_unlocked(f, &line);
+    if (n >= 0 && (size_t) n + 1 > *capp) {
+        char* buf = (char*) realloc(*bufp, n + 1);
+        if (buf) {
+            *bufp = buf;
+            *capp = n + 1;
+        } else
+            n = -1;
+    }
+    if (n >= 0) {
+        memcpy(*bufp, line, n);
+        (*bufp)[n] = '\0';
+    }
+    if (f->locking)
+        io61_unlock(f);
+    return n;
+}
+
+
+// io61_copy(inf, outf, sz)
+//    Call io61_copy_unlocked, holding the locks of files in locked mode
+//    (in address order, so concurrent copies can't deadlock).
+
+ssize_t io61_copy(io61_file* inf, io61_file* outf, size_t sz) {
+    io61_file* a = inf < outf ? inf : outf;
+    io61_file* b = inf < outf ? outf : inf;
+    if (a->locking)
+        io61_lock(a);
+    if (b->locking)
+        io61_lock(b);
+    ssize_t n = io61_copy_unlocked(inf, outf, sz);
+    if (b->locking)
+        io61_unlock(b);
+    if (a->locking)
+        io61_unlock(a);
+    return n;
+}
+
+
 // You shouldn't need to change these functions.
 
 // io61_open_check(filename, mode)
@@ -400,9 +3123,12 @@ int io61_seek(io61_file* f, off_t pos) {
 
 io61_file* io61_open_check(const char* filename, int mode) {
     int fd;
-    if (filename)
+    if (filename) {
         fd = open(filename, mode, 0666);
-    else if ((mode & O_ACCMODE) == O_RDONLY)
+        // Some file systems reject O_DIRECT; use the page cache there
+        if (fd < 0 && errno == EINVAL && (mode & O_DIRECT))
+            fd = open(filename, mode & ~O_DIRECT, 0666);
+    } else if ((mode & O_ACCMODE) == O_RDONLY)
         fd = STDIN_FILENO;
     else
         fd = STDOUT_FILENO;
@@ -410,7 +3136,7 @@ io61_file* io61_open_check(const char* filename, int mode) {
         fprintf(stderr, "%s: %s\n", filename, strerror(errno));
         exit(1);
     }
-    return io61_fdopen(fd, mode & O_ACCMODE);
+    return io61_fdopen(fd, mode & (O_ACCMODE | O_DIRECT));
 }
 
 
@@ -433,8 +3159,14 @@ off_t io61_filesize(io61_file* f) {
 //    immediately after a `read` call that returned 0 or -1.
 
 int io61_eof(io61_file* f) {
+    // A direct I/O file can't read one byte; compare with its size
+    if (f->direct) {
+        off_t size = io61_filesize(f);
+        return size >= 0 && io61_tell(f) >= size;
+    }
     char x;
     ssize_t nread = read(f->fd, &x, 1);
+    ++f->stats.reads;
     if (nread == 1) {
         fprintf(stderr, "Error: io61_eof called improperly\n\
   (Only call immediately after a read() that returned 0 or -1.)\n");
@@ -1,11 +1,15 @@
 #ifndef IO61_H
 #define IO61_H
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE 1           // for O_DIRECT
+#endif
 #include <stdio.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <sys/uio.h>
 
 typedef struct io61_file io61_file;
 
@@ -17,15 +21,102 @@ off_t io61_filesize(io61_file* f);
 
 int io61_seek(io61_file* f, off_t pos);
 
-int io61_readc(io61_file* f);
-int io61_writec(io61_file* f, int ch);
+int io61_setcache(io61_file* f, size_t block_size, size_t nblocks);
+int io61_setprefetch(io61_file* f, unsigned nbuffers);
+int io61_setmapwindow(io61_file* f, size_t window);
+int io61_setmapoutput(io61_file* f, int enable);
+int io61_seturing(io61_file* f, int enable);
+int io61_setwritebehind(io61_file* f, size_t limit);
+int io61_setpair(io61_file* inf, io61_file* outf);
+
+int io61_setlocking(io61_file* f, int enable);
+void io61_lock(io61_file* f);
+void io61_unlock(io61_file* f);
+
+
+// io61_buffer
+//    Every io61_file starts with an io61_buffer: a cursor into its
+//    buffered bytes. io61_readc and io61_writec are inline and only
+//    compare `cur` against the limit; they call io61_readc_slow or
+//    io61_writec_slow when the cursor runs out or the file is locked.
+
+typedef struct io61_buffer {
+    unsigned char* cur;         // next byte to read or write
+    unsigned char* rlim;        // end of readable bytes at `cur`
+    unsigned char* wlim;        // end of writable bytes at `cur`
+    int locking;                // 1 if every call takes the file's lock
+} io61_buffer;
+
+int io61_readc_slow(io61_file* f);
+int io61_writec_slow(io61_file* f, int ch);
+
+static inline int io61_readc_unlocked(io61_file* f) {
+    io61_buffer* b = (io61_buffer*) f;
+    return b->cur < b->rlim ? *b->cur++ : io61_readc_slow(f);
+}
+
+static inline int io61_writec_unlocked(io61_file* f, int ch) {
+    io61_buffer* b = (io61_buffer*) f;
+    if (b->cur < b->wlim) {
+        *b->cur++ = ch;
+        return 0;
+    }
+    return io61_writec_slow(f, ch);
+}
+
+static inline int io61_readc(io61_file* f) {
+    io61_buffer* b = (io61_buffer*) f;
+    if (!b->locking && b->cur < b->rlim)
+        return *b->cur++;
+    return io61_readc_slow(f);
+}
+
+static inline int io61_writec(io61_file* f, int ch) {
+    io61_buffer* b = (io61_buffer*) f;
+    if (!b->locking && b->cur < b->wlim) {
+        *b->cur++ = ch;
+        return 0;
+    }
+    return io61_writec_slow(f, ch);
+}
+
 
 ssize_t io61_read(io61_file* f, char* buf, size_t sz);
 ssize_t io61_write(io61_file* f, const char* buf, size_t sz);
+ssize_t io61_pread(io61_file* f, char* buf, size_t sz, off_t off);
+ssize_t io61_pwrite(io61_file* f, const char* buf, size_t sz, off_t off);
+ssize_t io61_readline(io61_file* f, const char** line);
+ssize_t io61_getline(io61_file* f, char** bufp, size_t* capp);
+ssize_t io61_readv(io61_file* f, const struct iovec* iov, int iovcnt);
+ssize_t io61_writev(io61_file* f, const struct iovec* iov, int iovcnt);
+ssize_t io61_copy(io61_file* inf, io61_file* outf, size_t sz);
 
 int io61_eof(io61_file* f);
 int io61_flush(io61_file* f);
 
+
+// io61_counters
+//    I/O counters of a file, read with io61_stats. io61_stats_total
+//    sums the counters of all closed files.
+
+typedef struct io61_counters {
+    unsigned long long reads;           // read system calls
+    unsigned long long writes;          // write system calls
+    unsigned long long seeks;           // lseek system calls
+    unsigned long long maps;            // mmap, mremap and munmap calls
+    unsigned long long copies;          // in-kernel copies (io61_copy)
+    unsigned long long bytes_read;      // bytes read by system calls
+    unsigned long long bytes_written;   // bytes written by system calls
+    unsigned long long hits;            // refills served from memory
+    unsigned long long misses;          // refills that read the file
+    unsigned long long seek_misses;     // seeks away from cached data
+    unsigned long long flushes;         // writes of dirty cached data
+    unsigned long long flush_bytes;     // bytes written by those writes
+} io61_counters;
+
+int io61_stats(io61_file* f, io61_counters* out);
+void io61_stats_total(io61_counters* out);
+
 void io61_profile_begin(void);
 void io61_profile_end(void);
 
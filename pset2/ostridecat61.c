@@ -1,18 +1,26 @@
 #include "io61.h"
 
-// Usage: ./ostridecat61 [-b BLOCKSIZE] [-t STRIDE] [FILE]
+// Usage: ./ostridecat61 [-p] [-b BLOCKSIZE] [-t STRIDE] [FILE]
 //    Copies the input FILE to standard output in blocks, shuffling its
 //    contents. Reads FILE sequentially, but writes to standard output in a
 //    strided access pattern. Default BLOCKSIZE is 1 and default STRIDE is
 //    1024. This means the output file's bytes are written in the sequence
-//    0, 1024, 2048, ..., 1, 1025, 2049, ..., etc.
+//    0, 1024, 2048, ..., 1, 1025, 2049, ..., etc. With -p, every seek
+//    first probes past the end of the output, which must not change the
+//    output file.
 
 int main(int argc, char** argv) {
     // Parse arguments
     size_t blocksize = 1;
     size_t stride = 1024;
-    while (argc >= 3) {
-        if (strcmp(argv[1], "-b") == 0) {
+    int probe = 0;
+    while (argc >= 2) {
+        if (strcmp(argv[1], "-p") == 0) {
+            probe = 1;
+            argc -= 1, argv += 1;
+        } else if (argc < 3)
+            break;
+        else if (strcmp(argv[1], "-b") == 0) {
             blocksize = strtoul(argv[2], 0, 0);
             argc -= 2, argv += 2;
         } else if (strcmp(argv[1], "-t") == 0) {
@@ -59,6 +67,8 @@ int main(int argc, char** argv) {
             if (pos + blocksize > stride)
                 blocksize = stride - pos;
         }
+        if (probe)
+            io61_seek(outf, inf_size + stride);
         int r = io61_seek(outf, pos);
         assert(r >= 0);
     }
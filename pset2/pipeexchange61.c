@@ -5,6 +5,14 @@
 #include <signal.h>
 #include <sys/wait.h>
 
+// Usage: ./pipeexchange61 [-a]
+//    Exchanges batches of requests and responses between two processes
+//    over a pair of pipes. Each side flushes its output by hand after
+//    every batch, or, with -a, pairs its input with its output using
+//    io61_setpair, so output is flushed whenever a read would block.
+
+static int autoflush = 0;
+
 struct message_set {
     int request_batch;
     size_t request_size;
@@ -50,6 +58,8 @@ static size_t max_message_size(void) {
 }
 
 void requester(io61_file* outf, io61_file* inf) {
+    if (autoflush)
+        io61_setpair(inf, outf);
     size_t nmessages = sizeof(messages) / sizeof(messages[0]);
     size_t maxsz = max_message_size();
 
@@ -69,8 +79,10 @@ void requester(io61_file* outf, io61_file* inf) {
             ssize_t r = io61_write(outf, buf, m->request_size);
             assert((size_t) r == m->request_size);
         }
-        int x = io61_flush(outf);
-        assert(x >= 0);
+        if (!autoflush) {
+            int x = io61_flush(outf);
+            assert(x >= 0);
+        }
         for (int i = 0; i < m->request_batch; ++i) {
             ssize_t r = io61_read(inf, buf, m->response_size);
             assert((size_t) r == m->response_size);
@@ -88,6 +100,8 @@ void requester(io61_file* outf, io61_file* inf) {
 }
 
 void responder(io61_file* outf, io61_file* inf) {
+    if (autoflush)
+        io61_setpair(inf, outf);
     size_t nmessages = sizeof(messages) / sizeof(messages[0]);
     size_t maxsz = max_message_size();
     char* buf = (char*) malloc(maxsz);
@@ -100,8 +114,10 @@ void responder(io61_file* outf, io61_file* inf) {
             assert((size_t) r == m->request_size);
             r = io61_write(outf, buf, m->response_size);
             assert((size_t) r == m->response_size);
-            int x = io61_flush(outf);
-            assert(x >= 0);
+            if (!autoflush) {
+                int x = io61_flush(outf);
+                assert(x >= 0);
+            }
         }
     }
 
@@ -112,7 +128,8 @@ void responder(io61_file* outf, io61_file* inf) {
 }
 
 int main(int argc, char** argv) {
-    (void) argc, (void) argv;
+    if (argc >= 2 && strcmp(argv[1], "-a") == 0)
+        autoflush = 1;
 
     // create a connected socket pair for communicating between processes
     int request_fds[2], response_fds[2];
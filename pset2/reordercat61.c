@@ -1,19 +1,64 @@
 #include "io61.h"
+#include <pthread.h>
 
-// Usage: ./reordercat61 [-b BLOCKSIZE] [-r RANDOMSEED] [-s SIZE] [FILE]
+// Usage: ./reordercat61 [-p] [-t THREADS] [-b BLOCKSIZE] [-r RANDOMSEED]
+//                       [-s SIZE] [FILE]
 //    Copies the input FILE to standard output in blocks. The blocks
 //    are transferred in random order, but the resulting output file
-//    should be the same as the input. Default BLOCKSIZE is 4096.
+//    should be the same as the input. With -p, blocks are transferred
+//    with io61_pread and io61_pwrite instead of seeks. With -t, THREADS
+//    threads share the files in locked mode (implies -p).
+//    Default BLOCKSIZE is 4096.
+
+static io61_file* inf;
+static io61_file* outf;
+static size_t blocksize = 4096;
+static size_t* blockpos;
+static size_t nblocks;
+
+static void* copy_blocks(void* arg) {
+    char* buf = (char*) malloc(blocksize);
+    while (1) {
+        // Choose block to read, holding the input's lock
+        io61_lock(inf);
+        if (nblocks == 0) {
+            io61_unlock(inf);
+            break;
+        }
+        size_t index = random() % nblocks;
+        size_t pos = blockpos[index] * blocksize;
+        blockpos[index] = blockpos[nblocks - 1];
+        --nblocks;
+        io61_unlock(inf);
+
+        // Transfer that block
+        ssize_t amount = io61_pread(inf, buf, blocksize, pos);
+        if (amount <= 0)
+            break;
+        io61_pwrite(outf, buf, amount, pos);
+    }
+    free(buf);
+    return arg;
+}
 
 int main(int argc, char** argv) {
     // Parse arguments
-    size_t blocksize = 4096;
     size_t inf_size = -1;
+    int positional = 0;
+    int nthreads = 0;
     srandom(83419);
-    while (argc >= 3) {
-        if (strcmp(argv[1], "-b") == 0) {
+    while (argc >= 2) {
+        if (strcmp(argv[1], "-p") == 0) {
+            positional = 1;
+            argc -= 1, argv += 1;
+        } else if (argc < 3)
+            break;
+        else if (strcmp(argv[1], "-b") == 0) {
             blocksize = strtoul(argv[2], 0, 0);
             argc -= 2, argv += 2;
+        } else if (strcmp(argv[1], "-t") == 0) {
+            nthreads = strtol(argv[2], 0, 0);
+            argc -= 2, argv += 2;
         } else if (strcmp(argv[1], "-r") == 0) {
             srandom(strtoul(argv[2], 0, 0));
             argc -= 2, argv += 2;
@@ -30,7 +75,7 @@ int main(int argc, char** argv) {
 
     const char* in_filename = argc >= 2 ? argv[1] : NULL;
     io61_profile_begin();
-    io61_file* inf = io61_open_check(in_filename, O_RDONLY);
+    inf = io61_open_check(in_filename, O_RDONLY);
 
     if ((ssize_t) inf_size < 0)
         inf_size = io61_filesize(inf);
@@ -43,14 +88,14 @@ int main(int argc, char** argv) {
         exit(1);
     }
 
-    io61_file* outf = io61_fdopen(STDOUT_FILENO, O_WRONLY);
+    outf = io61_fdopen(STDOUT_FILENO, O_WRONLY);
     if (io61_seek(outf, 0) < 0) {
         fprintf(stderr, "reordercat61: output file is not seekable\n");
         exit(1);
     }
 
     // Calculate random permutation of file's blocks
-    size_t nblocks = inf_size / blocksize;
+    nblocks = inf_size / blocksize;
     if (nblocks > (30 << 20)) {
         fprintf(stderr, "reordercat61: file too large\n");
         exit(1);
@@ -59,11 +104,21 @@ int main(int argc, char** argv) {
         exit(1);
     }
 
-    size_t* blockpos = (size_t*) malloc(sizeof(size_t) * nblocks);
+    blockpos = (size_t*) malloc(sizeof(size_t) * nblocks);
     for (size_t i = 0; i < nblocks; ++i)
         blockpos[i] = i;
 
     // Copy file data
+    if (nthreads > 0) {
+        io61_setlocking(inf, 1);
+        io61_setlocking(outf, 1);
+        pthread_t* threads = (pthread_t*) malloc(sizeof(pthread_t) * nthreads);
+        for (int i = 0; i < nthreads; ++i)
+            pthread_create(&threads[i], NULL, copy_blocks, NULL);
+        for (int i = 0; i < nthreads; ++i)
+            pthread_join(threads[i], NULL);
+        free(threads);
+    }
     while (nblocks != 0) {
         // Choose block to read
         size_t index = random() % nblocks;
@@ -72,6 +127,13 @@ int main(int argc, char** argv) {
         --nblocks;
 
         // Transfer that block
+        if (positional) {
+            ssize_t amount = io61_pread(inf, buf, blocksize, pos);
+            if (amount <= 0)
+                break;
+            io61_pwrite(outf, buf, amount, pos);
+            continue;
+        }
         io61_seek(inf, pos);
         ssize_t amount = io61_read(inf, buf, blocksize);
         if (amount <= 0)
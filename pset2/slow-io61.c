@@ -12,7 +12,11 @@
 //    Data structure for io61 file wrappers.
 
 struct io61_file {
+    io61_buffer buf;            // always empty, so io61_readc calls out
     int fd;
+    char* line;                 // io61_readline buffer
+    size_t line_cap;            // bytes allocated at `line`
+    io61_counters stats;        // I/O counters, for io61_stats
 };
 
 
@@ -25,7 +29,11 @@ struct io61_file {
 io61_file* io61_fdopen(int fd, int mode) {
     assert(fd >= 0);
     io61_file* f = (io61_file*) malloc(sizeof(io61_file));
+    memset(&f->buf, 0, sizeof(f->buf));
     f->fd = fd;
+    f->line = NULL;
+    f->line_cap = 0;
+    memset(&f->stats, 0, sizeof(f->stats));
     (void) mode;
     return f;
 }
@@ -33,25 +41,35 @@ io61_file* io61_fdopen(int fd, int mode) {
 
 // io61_close(f)
 //    Close the io61_file `f` and release all its resources, including
-//    any buffers.
+//    any buffers. Its counters are added to `total`.
+
+static io61_counters total;
 
 int io61_close(io61_file* f) {
     io61_flush(f);
     int r = close(f->fd);
+    total.reads += f->stats.reads;
+    total.writes += f->stats.writes;
+    total.seeks += f->stats.seeks;
+    total.bytes_read += f->stats.bytes_read;
+    total.bytes_written += f->stats.bytes_written;
+    free(f->line);
     free(f);
     return r;
 }
 
 
-// io61_readc(f)
+// io61_readc_slow(f)
 //    Read a single (unsigned) character from `f` and return it. Returns EOF
 //    (which is -1) on error or end-of-file.
 
-int io61_readc(io61_file* f) {
+int io61_readc_slow(io61_file* f) {
     unsigned char buf[1];
-    if (read(f->fd, buf, 1) == 1)
+    ++f->stats.reads;
+    if (read(f->fd, buf, 1) == 1) {
+        ++f->stats.bytes_read;
         return buf[0];
-    else
+    } else
         return EOF;
 }
 
@@ -78,16 +96,18 @@ ssize_t io61_read(io61_file* f, char* buf, size_t sz) {
 }
 
 
-// io61_writec(f)
+// io61_writec_slow(f, ch)
 //    Write a single character `ch` to `f`. Returns 0 on success or
 //    -1 on error.
 
-int io61_writec(io61_file* f, int ch) {
+int io61_writec_slow(io61_file* f, int ch) {
     unsigned char buf[1];
     buf[0] = ch;
-    if (write(f->fd, buf, 1) == 1)
+    ++f->stats.writes;
+    if (write(f->fd, buf, 1) == 1) {
+        ++f->stats.bytes_written;
         return 0;
-    else
+    } else
         return -1;
 }
 
@@ -111,6 +131,165 @@ ssize_t io61_write(io61_file* f, const char* buf, size_t sz) {
 }
 
 
+// io61_pread(f, buf, sz, off)
+// io61_pwrite(f, buf, sz, off)
+//    Read or write up to `sz` characters at file offset `off` without
+//    changing the file position. Returns -1 if `f` can't seek.
+
+ssize_t io61_pread(io61_file* f, char* buf, size_t sz, off_t off) {
+    ssize_t n = pread(f->fd, buf, sz, off);
+    ++f->stats.reads;
+    if (n > 0)
+        f->stats.bytes_read += n;
+    return n;
+}
+
+ssize_t io61_pwrite(io61_file* f, const char* buf, size_t sz, off_t off) {
+    ssize_t n = pwrite(f->fd, buf, sz, off);
+    ++f->stats.writes;
+    if (n > 0)
+        f->stats.bytes_written += n;
+    return n;
+}
+
+
+// io61_readline(f, line)
+// io61_getline(f, bufp, capp)
+//    Read the next line of `f`, including its newline. io61_readline
+//    sets `*line` to a buffer valid until the next call on `f`;
+//    io61_getline copies the line into `*bufp`, growing it with realloc
+//    as needed, and null-terminates it. Both return the line's length,
+//    0 at end-of-file, or -1 on error.
+
+ssize_t io61_readline(io61_file* f, const char** line) {
+    size_t len = 0;
+    int ch = 0;
+    while (ch != '\n' && (ch = io61_readc(f)) != EOF) {
+        if (len == f->line_cap) {
+            size_t cap = f->line_cap ? f->line_cap * 2 : 128;
+            char* p = (char*) realloc(f->line, cap);
+            if (!p)
+                return -1;
+            f->line = p;
+            f->line_cap = cap;
+        }
+        f->line[len] = ch;
+        ++len;
+    }
+    *line = f->line;
+    return len;
+}
+
+ssize_t io61_getline(io61_file* f, char** bufp, size_t* capp) {
+    const char* line = "";
+    ssize_t n = io61_readline(f, &line);
+    if (n >= 0 && (size_t) n + 1 > *capp) {
+        char* buf = (char*) realloc(*bufp, n + 1);
+        if (!buf)
+            return -1;
+        *bufp = buf;
+        *capp = n + 1;
+    }
+    if (n >= 0) {
+        memcpy(*bufp, line, n);
+        (*bufp)[n] = '\0';
+    }
+    return n;
+}
+
+
+// io61_readv(f, iov, iovcnt)
+// io61_writev(f, iov, iovcnt)
+//    Read into or write from the `iovcnt` buffers described by `iov`,
+//    in order, like io61_read and io61_write.
+
+ssize_t io61_readv(io61_file* f, const struct iovec* iov, int iovcnt) {
+    size_t nread = 0;
+    for (int i = 0; i < iovcnt; ++i) {
+        ssize_t n = io61_read(f, (char*) iov[i].iov_base, iov[i].iov_len);
+        if (n < 0)
+            return nread ? (ssize_t) nread : -1;
+        nread += n;
+        if ((size_t) n != iov[i].iov_len)
+            break;
+    }
+    return nread;
+}
+
+ssize_t io61_writev(io61_file* f, const struct iovec* iov, int iovcnt) {
+    size_t nwritten = 0;
+    for (int i = 0; i < iovcnt; ++i) {
+        ssize_t n = io61_write(f, (const char*) iov[i].iov_base, iov[i].iov_len);
+        if (n < 0)
+            return nwritten ? (ssize_t) nwritten : -1;
+        nwritten += n;
+        if ((size_t) n != iov[i].iov_len)
+            break;
+    }
+    return nwritten;
+}
+
+
+// io61_copy(inf, outf, sz)
+//    Copy up to `sz` bytes from `inf` to `outf`. Returns the number of
+//    bytes copied, or -1 if an error occurred before any were copied.
+
+ssize_t io61_copy(io61_file* inf, io61_file* outf, size_t sz) {
+    size_t ncopied = 0;
+    while (ncopied != sz) {
+        int ch = io61_readc(inf);
+        if (ch == EOF || io61_writec(outf, ch) == -1)
+            break;
+        ++ncopied;
+    }
+    return ncopied;
+}
+
+
+// io61_setlocking(f, enable)
+// io61_lock(f)
+// io61_unlock(f)
+//    This version keeps no state between calls, so it needs no locks.
+
+int io61_setlocking(io61_file* f, int enable) {
+    (void) f, (void) enable;
+    return 0;
+}
+
+void io61_lock(io61_file* f) {
+    (void) f;
+}
+
+void io61_unlock(io61_file* f) {
+    (void) f;
+}
+
+
+// io61_setpair(inf, outf)
+//    This version doesn't buffer output, so pairing has nothing to
+//    flush. Returns 0.
+
+int io61_setpair(io61_file* inf, io61_file* outf) {
+    (void) inf, (void) outf;
+    return 0;
+}
+
+
+// io61_stats(f, out)
+// io61_stats_total(out)
+//    Store the I/O counters of `f`, or the sum of those of all closed
+//    files, in `*out`.
+
+int io61_stats(io61_file* f, io61_counters* out) {
+    *out = f->stats;
+    return 0;
+}
+
+void io61_stats_total(io61_counters* out) {
+    *out = total;
+}
+
+
 // io61_flush(f)
 //    Forces a write of all buffered data written to `f`.
 //    If `f` was opened read-only, io61_flush(f) may either drop all
@@ -128,6 +307,7 @@ int io61_flush(io61_file* f) {
 
 int io61_seek(io61_file* f, off_t pos) {
     off_t r = lseek(f->fd, (off_t) pos, SEEK_SET);
+    ++f->stats.seeks;
     if (r == (off_t) pos)
         return 0;
     else
@@ -141,12 +321,13 @@ int io61_seek(io61_file* f, off_t pos) {
 //    Open the file corresponding to `filename` and return its io61_file.
 //    If `filename == NULL`, returns either the standard input or the
 //    standard output, depending on `mode`. Exits with an error message if
-//    `filename != NULL` and the named file cannot be opened.
+//    `filename != NULL` and the named file cannot be opened. This version
+//    ignores O_DIRECT.
 
 io61_file* io61_open_check(const char* filename, int mode) {
     int fd;
     if (filename)
-        fd = open(filename, mode, 0666);
+        fd = open(filename, mode & ~O_DIRECT, 0666);
     else if ((mode & O_ACCMODE) == O_RDONLY)
         fd = STDIN_FILENO;
     else
@@ -12,7 +12,11 @@
 //    Data structure for io61 file wrappers.
 
 struct io61_file {
+    io61_buffer buf;            // always empty, so io61_readc calls out
     FILE* f;
+    struct io61_file* pair;     // paired input or output, or NULL
+    char* line;                 // io61_readline buffer
+    size_t line_cap;            // bytes allocated at `line`
 };
 
 
@@ -25,7 +29,11 @@ struct io61_file {
 io61_file* io61_fdopen(int fd, int mode) {
     assert(fd >= 0);
     io61_file* f = (io61_file*) malloc(sizeof(io61_file));
-    f->f = fdopen(fd, mode == O_RDONLY ? "r" : "w");
+    memset(&f->buf, 0, sizeof(f->buf));
+    f->f = fdopen(fd, (mode & O_ACCMODE) == O_RDONLY ? "r" : "w");
+    f->pair = NULL;
+    f->line = NULL;
+    f->line_cap = 0;
     return f;
 }
 
@@ -37,16 +45,31 @@ io61_file* io61_fdopen(int fd, int mode) {
 int io61_close(io61_file* f) {
     io61_flush(f);
     int r = fclose(f->f);
+    if (f->pair)
+        f->pair->pair = NULL;
+    free(f->line);
     free(f);
     return r;
 }
 
 
-// io61_readc(f)
+// io61_flushpair(f)
+//    Flush the output paired with input `f`, if any. Stdio can't tell
+//    whether a read would block, so paired inputs flush before every
+//    read.
+
+static void io61_flushpair(io61_file* f) {
+    if (f->pair)
+        fflush(f->pair->f);
+}
+
+
+// io61_readc_slow(f)
 //    Read a single (unsigned) character from `f` and return it. Returns EOF
 //    (which is -1) on error or end-of-file.
 
-int io61_readc(io61_file* f) {
+int io61_readc_slow(io61_file* f) {
+    io61_flushpair(f);
     return fgetc(f->f);
 }
 
@@ -58,6 +81,7 @@ int io61_readc(io61_file* f) {
 //    -1 an error occurred before any characters were read.
 
 ssize_t io61_read(io61_file* f, char* buf, size_t sz) {
+    io61_flushpair(f);
     size_t n = fread(buf, 1, sz, f->f);
     if (n != 0 || sz == 0 || !ferror(f->f))
         return (ssize_t) n;
@@ -66,12 +90,12 @@ ssize_t io61_read(io61_file* f, char* buf, size_t sz) {
 }
 
 
-// io61_writec(f)
+// io61_writec_slow(f, ch)
 //    Write a single character `ch` to `f`. Returns 0 on success or
 //    -1 on error.
 
-int io61_writec(io61_file* f, int ch) {
-    return fputc(ch, f->f);
+int io61_writec_slow(io61_file* f, int ch) {
+    return fputc(ch, f->f) == EOF ? -1 : 0;
 }
 
 
@@ -89,6 +113,187 @@ ssize_t io61_write(io61_file* f, const char* buf, size_t sz) {
 }
 
 
+// io61_pread(f, buf, sz, off)
+// io61_pwrite(f, buf, sz, off)
+//    Read or write up to `sz` characters at file offset `off` without
+//    changing the file position. Returns -1 if `f` can't seek. Holds the
+//    stream lock so other threads never see the temporary position.
+
+ssize_t io61_pread(io61_file* f, char* buf, size_t sz, off_t off) {
+    flockfile(f->f);
+    off_t pos = ftello(f->f);
+    ssize_t n = -1;
+    if (pos >= 0 && fseeko(f->f, off, SEEK_SET) >= 0) {
+        n = io61_read(f, buf, sz);
+        fseeko(f->f, pos, SEEK_SET);
+    }
+    funlockfile(f->f);
+    return n;
+}
+
+ssize_t io61_pwrite(io61_file* f, const char* buf, size_t sz, off_t off) {
+    flockfile(f->f);
+    off_t pos = ftello(f->f);
+    ssize_t n = -1;
+    if (pos >= 0 && fseeko(f->f, off, SEEK_SET) >= 0) {
+        n = io61_write(f, buf, sz);
+        fseeko(f->f, pos, SEEK_SET);
+    }
+    funlockfile(f->f);
+    return n;
+}
+
+
+// io61_readline(f, line)
+// io61_getline(f, bufp, capp)
+//    Read the next line of `f`, including its newline. io61_readline
+//    sets `*line` to a buffer valid until the next call on `f`;
+//    io61_getline copies the line into `*bufp`, growing it with realloc
+//    as needed, and null-terminates it. Both return the line's length,
+//    0 at end-of-file, or -1 on error.
+
+ssize_t io61_readline(io61_file* f, const char** line) {
+    io61_flushpair(f);
+    ssize_t n = getline(&f->line, &f->line_cap, f->f);
+    if (n < 0)
+        return ferror(f->f) ? -1 : 0;
+    *line = f->line;
+    return n;
+}
+
+ssize_t io61_getline(io61_file* f, char** bufp, size_t* capp) {
+    const char* line = "";
+    ssize_t n = io61_readline(f, &line);
+    if (n >= 0 && (size_t) n + 1 > *capp) {
+        char* buf = (char*) realloc(*bufp, n + 1);
+        if (!buf)
+            return -1;
+        *bufp = buf;
+        *capp = n + 1;
+    }
+    if (n >= 0) {
+        memcpy(*bufp, line, n);
+        (*bufp)[n] = '\0';
+    }
+    return n;
+}
+
+
+// io61_readv(f, iov, iovcnt)
+// io61_writev(f, iov, iovcnt)
+//    Read into or write from the `iovcnt` buffers described by `iov`,
+//    in order, like io61_read and io61_write.
+
+ssize_t io61_readv(io61_file* f, const struct iovec* iov, int iovcnt) {
+    io61_flushpair(f);
+    size_t nread = 0;
+    for (int i = 0; i < iovcnt; ++i) {
+        size_t n = fread(iov[i].iov_base, 1, iov[i].iov_len, f->f);
+        nread += n;
+        if (n != iov[i].iov_len)
+            break;
+    }
+    if (nread != 0 || !ferror(f->f))
+        return nread;
+    else
+        return -1;
+}
+
+ssize_t io61_writev(io61_file* f, const struct iovec* iov, int iovcnt) {
+    size_t nwritten = 0;
+    for (int i = 0; i < iovcnt; ++i) {
+        size_t n = fwrite(iov[i].iov_base, 1, iov[i].iov_len, f->f);
+        nwritten += n;
+        if (n != iov[i].iov_len)
+            break;
+    }
+    if (nwritten != 0 || !ferror(f->f))
+        return nwritten;
+    else
+        return -1;
+}
+
+
+// io61_copy(inf, outf, sz)
+//    Copy up to `sz` bytes from `inf` to `outf`. Returns the number of
+//    bytes copied, or -1 if an error occurred before any were copied.
+
+ssize_t io61_copy(io61_file* inf, io61_file* outf, size_t sz) {
+    char buf[BUFSIZ];
+    size_t ncopied = 0;
+    io61_flushpair(inf);
+    while (ncopied != sz) {
+        size_t n = fread(buf, 1, sz - ncopied < BUFSIZ ? sz - ncopied : BUFSIZ, inf->f);
+        if (n == 0 || fwrite(buf, 1, n, outf->f) != n)
+            break;
+        ncopied += n;
+    }
+    if (ncopied != 0 || sz == 0 || (!ferror(inf->f) && !ferror(outf->f)))
+        return ncopied;
+    else
+        return -1;
+}
+
+
+// io61_setlocking(f, enable)
+// io61_lock(f)
+// io61_unlock(f)
+//    Stdio streams always lock, so io61_setlocking does nothing;
+//    io61_lock and io61_unlock are flockfile and funlockfile. The
+//    `_unlocked` character functions go through fgetc and fputc too.
+
+int io61_setlocking(io61_file* f, int enable) {
+    (void) f, (void) enable;
+    return 0;
+}
+
+void io61_lock(io61_file* f) {
+    flockfile(f->f);
+}
+
+void io61_unlock(io61_file* f) {
+    funlockfile(f->f);
+}
+
+
+// io61_setpair(inf, outf)
+//    Pair input `inf` with output `outf`, so `outf` is flushed before
+//    reads of `inf`. `outf` NULL unpairs `inf`. Returns 0. Stdio can't
+//    read while a write would block, so paired pipes are enlarged
+//    instead, letting both sides write a whole batch without waiting.
+
+int io61_setpair(io61_file* inf, io61_file* outf) {
+    if (inf->pair)
+        inf->pair->pair = NULL;
+    inf->pair = outf;
+    if (outf) {
+        if (outf->pair)
+            outf->pair->pair = NULL;
+        outf->pair = inf;
+        (void) fcntl(fileno(inf->f), F_SETPIPE_SZ, 1 << 20);
+        (void) fcntl(fileno(outf->f), F_SETPIPE_SZ, 1 << 20);
+    }
+    return 0;
+}
+
+
+// io61_stats(f, out)
+// io61_stats_total(out)
+//    Store the I/O counters of `f`, or the sum of those of all closed
+//    files, in `*out`. Stdio's system calls are hidden, so these are
+//    all zero.
+
+int io61_stats(io61_file* f, io61_counters* out) {
+    (void) f;
+    memset(out, 0, sizeof(*out));
+    return 0;
+}
+
+void io61_stats_total(io61_counters* out) {
+    memset(out, 0, sizeof(*out));
+}
+
+
 // io61_flush(f)
 //    Forces a write of all buffered data written to `f`.
 //    If `f` was opened read-only, io61_flush(f) may either drop all
@@ -116,12 +321,13 @@ int io61_seek(io61_file* f, off_t pos) {
 //    Open the file corresponding to `filename` and return its io61_file.
 //    If `filename == NULL`, returns either the standard input or the
 //    standard output, depending on `mode`. Exits with an error message if
-//    `filename != NULL` and the named file cannot be opened.
+//    `filename != NULL` and the named file cannot be opened. This version
+//    ignores O_DIRECT.
 
 io61_file* io61_open_check(const char* filename, int mode) {
     int fd;
     if (filename)
-        fd = open(filename, mode, 0666);
+        fd = open(filename, mode & ~O_DIRECT, 0666);
     else if ((mode & O_ACCMODE) == O_RDONLY)
         fd = STDIN_FILENO;
     else